@@ -0,0 +1,424 @@
+#define _GNU_SOURCE
+
+#include <linux/videodev2.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "automode.h"
+
+#define MAX_MODES	256
+
+struct modes
+{
+	struct auto_mode mode[MAX_MODES];
+	int count;
+};
+
+int auto_parse (struct auto_goal *goal, char *spec)
+{
+	char *const tokens[] = { "w", "h", "fps", "h264", "bw", "cache", "tries", NULL, };
+
+	while (*spec)
+	{
+		char *value;
+		int i;
+
+		i = getsubopt (&spec, tokens, &value);
+		if (i < 0 || (i != 3 && !value))
+		{
+			fprintf (stderr, "bad goal option \"%s\", w=,h=,fps=,h264,bw=,cache=,tries=\n", value ? value : "");
+			return -1;
+		}
+		switch (i)
+		{
+			case 0: goal->width = atoi (value); break;
+			case 1: goal->height = atoi (value); break;
+			case 2: goal->fps = atoi (value); break;
+			case 3: goal->h264 = 1; break;
+			case 4: goal->bandwidth = atof (value) * 1e6; break;
+			case 5: goal->cache = value; break;
+			case 6: goal->tries = atoi (value); break;
+		}
+	}
+
+	if (goal->width < 0 || goal->height < 0 || goal->fps < 0 || goal->bandwidth < 0 || goal->tries < 1)
+	{
+		fprintf (stderr, "goal options out of range\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static double mode_fps (const struct auto_mode *m)
+{
+	return (double) m->fr_den / m->fr_num;
+}
+
+/* rough bytes per pixel, compressed formats by typical bitrates */
+static double estimate (uint32_t pixelformat, int width, int height, double fps)
+{
+	double bpp;
+
+	switch (pixelformat)
+	{
+		case V4L2_PIX_FMT_GREY:		bpp = 1; break;
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_NV12:		bpp = 1.5; break;
+		case V4L2_PIX_FMT_MJPEG:
+		case V4L2_PIX_FMT_JPEG:		bpp = 0.3; break;
+		case V4L2_PIX_FMT_H264:		bpp = 0.02; break;
+		default:			bpp = 2; break;
+	}
+
+	return bpp * width * height * fps;
+}
+
+/* usable bytes per second of the USB bus the device hangs off, 0 when unknown */
+static double bus_bandwidth (const char *device)
+{
+	char path[PATH_MAX];
+	char *real;
+	char *base;
+	FILE *fp;
+	int speed = 0;
+
+	real = realpath (device, NULL);
+	if (!real)
+		return 0;
+	base = strrchr (real, '/');
+	snprintf (path, sizeof (path), "/sys/class/video4linux/%s/device/../speed", base ? base + 1 : real);
+	free (real);
+
+	fp = fopen (path, "r");
+	if (!fp)
+		return 0;
+	if (fscanf (fp, "%d", &speed) != 1)
+		speed = 0;
+	fclose (fp);
+
+	/* isochronous payload, not the signalling rate */
+	if (speed >= 5000)
+		return 400e6;
+	if (speed >= 480)
+		return 24e6;
+	if (speed >= 12)
+		return 1e6;
+
+	return 0;
+}
+
+static void add_mode (struct modes *ms, uint32_t pixelformat, int width, int height, int num, int den)
+{
+	struct auto_mode *m;
+
+	if (ms->count == MAX_MODES || num <= 0 || den <= 0)
+		return;
+
+	m = &ms->mode[ms->count ++];
+	m->pixelformat = pixelformat;
+	m->width = width;
+	m->height = height;
+	m->fr_num = num;
+	m->fr_den = den;
+	m->bandwidth = estimate (pixelformat, width, height, mode_fps (m));
+}
+
+static void enum_intervals (int fd, struct modes *ms, const struct auto_goal *goal, uint32_t pixelformat, int width, int height)
+{
+	int k;
+
+	for (k=0; ; k++)
+	{
+		struct v4l2_frmivalenum ival;
+
+		memset (&ival, 0, sizeof (ival));
+		ival.index = k;
+		ival.pixel_format = pixelformat;
+		ival.width = width;
+		ival.height = height;
+
+		if (ioctl (fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival) < 0)
+			break;
+
+		if (ival.type == V4L2_FRMIVAL_TYPE_DISCRETE)
+		{
+			add_mode (ms, pixelformat, width, height, ival.discrete.numerator, ival.discrete.denominator);
+			continue;
+		}
+
+		/* stepwise, the fastest rate and the goal rate when it is in the range */
+		add_mode (ms, pixelformat, width, height, ival.stepwise.min.numerator, ival.stepwise.min.denominator);
+		if (goal->fps > 0 &&
+				(double) ival.stepwise.min.numerator / ival.stepwise.min.denominator <= 1.0 / goal->fps &&
+				(double) ival.stepwise.max.numerator / ival.stepwise.max.denominator >= 1.0 / goal->fps)
+			add_mode (ms, pixelformat, width, height, 1, goal->fps);
+		break;
+	}
+}
+
+static int step_up (int v, int min, int max, int step)
+{
+	if (v < min)
+		v = min;
+	if (step > 1)
+		v = min + (v - min + step - 1) / step * step;
+
+	return v > max ? max : v;
+}
+
+static void enum_modes (int fd, struct modes *ms, const struct auto_goal *goal)
+{
+	int i, j;
+
+	for (i=0; ; i++)
+	{
+		struct v4l2_fmtdesc fmt;
+
+		memset (&fmt, 0, sizeof (fmt));
+		fmt.index = i;
+		fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		if (ioctl (fd, VIDIOC_ENUM_FMT, &fmt) < 0)
+			break;
+
+		for (j=0; ; j++)
+		{
+			struct v4l2_frmsizeenum size;
+
+			memset (&size, 0, sizeof (size));
+			size.index = j;
+			size.pixel_format = fmt.pixelformat;
+			if (ioctl (fd, VIDIOC_ENUM_FRAMESIZES, &size) < 0)
+				break;
+
+			if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE)
+			{
+				enum_intervals (fd, ms, goal, fmt.pixelformat, size.discrete.width, size.discrete.height);
+				continue;
+			}
+
+			/* stepwise or continuous, the smallest size meeting the goal and the largest */
+			enum_intervals (fd, ms, goal, fmt.pixelformat,
+					step_up (goal->width, size.stepwise.min_width, size.stepwise.max_width, size.stepwise.step_width),
+					step_up (goal->height, size.stepwise.min_height, size.stepwise.max_height, size.stepwise.step_height));
+			enum_intervals (fd, ms, goal, fmt.pixelformat, size.stepwise.max_width, size.stepwise.max_height);
+			break;
+		}
+	}
+}
+
+static int h264_first;
+
+static int compare (const void *a, const void *b)
+{
+	const struct auto_mode *ma = a;
+	const struct auto_mode *mb = b;
+
+	if (h264_first && (ma->pixelformat == V4L2_PIX_FMT_H264) != (mb->pixelformat == V4L2_PIX_FMT_H264))
+		return ma->pixelformat == V4L2_PIX_FMT_H264 ? -1 : 1;
+	if (ma->bandwidth != mb->bandwidth)
+		return ma->bandwidth < mb->bandwidth ? -1 : 1;
+	if (mode_fps (ma) != mode_fps (mb))
+		return mode_fps (ma) > mode_fps (mb) ? -1 : 1;
+
+	return 0;
+}
+
+static void print_mode (const char *what, const struct auto_mode *m)
+{
+	fprintf (stderr, "%s%c%c%c%c %dx%d %d/%d (%.1f fps), ~%.1f MB/s\n", what,
+			(m->pixelformat >>  0) & 0xff,
+			(m->pixelformat >>  8) & 0xff,
+			(m->pixelformat >> 16) & 0xff,
+			(m->pixelformat >> 24) & 0xff,
+			m->width, m->height, m->fr_num, m->fr_den, mode_fps (m), m->bandwidth / 1e6);
+}
+
+/* cache lines are "<driver>/<card>\t<goal>\t<fourcc> <width> <height> <num> <den>" */
+static int cache_lookup (const char *cache, const char *key, struct auto_mode *out)
+{
+	char *line = NULL;
+	size_t len = 0;
+	size_t klen = strlen (key);
+	int found = 0;
+	FILE *fp;
+
+	fp = fopen (cache, "r");
+	if (!fp)
+		return 0;
+
+	while (!found && getline (&line, &len, fp) > 0)
+	{
+		char fourcc[5];
+
+		if (strncmp (line, key, klen) || line[klen] != '\t')
+			continue;
+		if (sscanf (line + klen + 1, "%4s %d %d %d %d", fourcc,
+					&out->width, &out->height, &out->fr_num, &out->fr_den) == 5 && strlen (fourcc) == 4)
+		{
+			out->pixelformat = v4l2_fourcc (fourcc[0], fourcc[1], fourcc[2], fourcc[3]);
+			out->bandwidth = estimate (out->pixelformat, out->width, out->height, mode_fps (out));
+			found = 1;
+		}
+	}
+	free (line);
+	fclose (fp);
+
+	return found;
+}
+
+static void cache_store (const char *cache, const char *key, const struct auto_mode *m)
+{
+	char *text = NULL;
+	char *line = NULL;
+	size_t len = 0;
+	size_t tlen = 0;
+	size_t klen = strlen (key);
+	FILE *out;
+	FILE *fp;
+
+	/* every other line is kept */
+	out = open_memstream (&text, &tlen);
+	if (!out)
+		return;
+	fp = fopen (cache, "r");
+	if (fp)
+	{
+		while (getline (&line, &len, fp) > 0)
+			if (strncmp (line, key, klen) || line[klen] != '\t')
+				fputs (line, out);
+		fclose (fp);
+	}
+	free (line);
+	fprintf (out, "%s\t%c%c%c%c %d %d %d %d\n", key,
+			(m->pixelformat >>  0) & 0xff,
+			(m->pixelformat >>  8) & 0xff,
+			(m->pixelformat >> 16) & 0xff,
+			(m->pixelformat >> 24) & 0xff,
+			m->width, m->height, m->fr_num, m->fr_den);
+	fclose (out);
+
+	fp = fopen (cache, "w");
+	if (fp)
+	{
+		fwrite (text, 1, tlen, fp);
+		fclose (fp);
+	}
+	else
+		error ("cannot write %s\n", cache);
+	free (text);
+}
+
+int auto_select (const char *device, const struct auto_goal *goal,
+		double (*measure) (void *arg, const struct auto_mode *mode), void *arg,
+		struct auto_mode *out)
+{
+	struct v4l2_capability caps = { };
+	struct modes *ms;
+	char *key = NULL;
+	double budget;
+	int ret = -1;
+	int fd;
+	int i, n;
+
+	fd = open (device, O_RDWR);
+	if (fd < 0)
+	{
+		error ("open failed. %s\n", device);
+		return -1;
+	}
+	if (ioctl (fd, VIDIOC_QUERYCAP, &caps) < 0)
+	{
+		error ("VIDIOC_QUERYCAP failed.\n");
+		close (fd);
+		return -1;
+	}
+
+	if (asprintf (&key, "%s/%s\tw=%d,h=%d,fps=%d,h264=%d", caps.driver, caps.card,
+				goal->width, goal->height, goal->fps, goal->h264) < 0)
+		key = NULL;
+	if (goal->cache && key && cache_lookup (goal->cache, key, out))
+	{
+		print_mode ("auto: cached ", out);
+		free (key);
+		close (fd);
+		return 0;
+	}
+
+	ms = calloc (1, sizeof (*ms));
+	if (!ms)
+		goto done;
+	enum_modes (fd, ms, goal);
+	close (fd);
+	fd = -1;
+
+	budget = goal->bandwidth > 0 ? goal->bandwidth : bus_bandwidth (device);
+	if (budget > 0)
+		fprintf (stderr, "auto: %d modes, bus budget %.1f MB/s\n", ms->count, budget / 1e6);
+	else
+		fprintf (stderr, "auto: %d modes, bus budget unknown\n", ms->count);
+
+	/* keep those meeting the goal */
+	for (i = 0, n = 0; i < ms->count; i ++)
+	{
+		struct auto_mode *m = &ms->mode[i];
+
+		if (m->width < goal->width || m->height < goal->height || mode_fps (m) < goal->fps)
+			continue;
+		if (budget > 0 && m->bandwidth > budget)
+			continue;
+		ms->mode[n ++] = *m;
+	}
+	ms->count = n;
+	if (!n)
+	{
+		fprintf (stderr, "auto: no mode meets the goal\n");
+		goto done;
+	}
+
+	h264_first = goal->h264;
+	qsort (ms->mode, ms->count, sizeof (ms->mode[0]), compare);
+
+	for (i = 0; i < ms->count && i < goal->tries; i ++)
+	{
+		struct auto_mode *m = &ms->mode[i];
+		double fps;
+
+		print_mode ("auto: trying ", m);
+		fps = measure (arg, m);
+		if (fps < 0)
+		{
+			fprintf (stderr, "auto: stopped\n");
+			goto done;
+		}
+		fprintf (stderr, "auto: delivered %.1f fps\n", fps);
+		if (fps >= 0.9 * mode_fps (m))
+		{
+			*out = *m;
+			print_mode ("auto: selected ", out);
+			if (goal->cache && key)
+				cache_store (goal->cache, key, out);
+			ret = 0;
+			break;
+		}
+	}
+	if (ret < 0)
+		fprintf (stderr, "auto: no mode delivered its frame rate\n");
+
+done:
+	free (ms);
+	free (key);
+	if (fd >= 0)
+		close (fd);
+	return ret;
+}
@@ -0,0 +1,50 @@
+#ifndef AUTOMODE_H
+#define AUTOMODE_H
+
+#include <stdint.h>
+
+/*
+ * Format, size and frame interval chosen from a goal.
+ *
+ * The modes of the device are enumerated like desc does, and those which
+ * meet the goal and fit the bus are ranked: H.264 first when asked, then
+ * the least estimated bandwidth, so the most headroom.  The best ones are
+ * verified in turn by streaming a moment and measuring the delivered fps,
+ * the first delivering at least 90% of its nominal rate is taken.
+ *
+ * With a cache file the result is kept per driver, card and goal, and
+ * reused next time without enumerating or verifying.
+ */
+
+struct auto_goal
+{
+	int width;		/* minimums */
+	int height;
+	int fps;
+	int h264;		/* prefer H.264 */
+	double bandwidth;	/* bytes per second, 0 from the bus speed */
+	char *cache;
+	int tries;		/* modes verified at most */
+};
+
+#define AUTO_GOAL_DEFAULT	{ .tries = 3, }
+
+struct auto_mode
+{
+	uint32_t pixelformat;
+	int width;
+	int height;
+	int fr_num;		/* seconds per frame, fr_num/fr_den */
+	int fr_den;
+	double bandwidth;	/* estimated bytes per second */
+};
+
+/* "w=<n>,h=<n>,fps=<n>,h264,bw=<MB/s>,cache=<file>,tries=<n>", returns -1 on a bad spec */
+int auto_parse (struct auto_goal *goal, char *spec);
+
+/* measure streams mode and returns the delivered fps, or -1 to stop selecting */
+int auto_select (const char *device, const struct auto_goal *goal,
+		double (*measure) (void *arg, const struct auto_mode *mode), void *arg,
+		struct auto_mode *out);
+
+#endif
@@ -0,0 +1,397 @@
+#define _GNU_SOURCE
+
+#include <linux/videodev2.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "rt.h"
+#include "burst.h"
+
+#define HUGE_PAGE	(2u << 20)
+
+enum burst_state
+{
+	BURST_IDLE,
+	BURST_ARMED,
+	BURST_RECORDING,
+	BURST_FLUSHING,
+};
+
+struct burst_frame
+{
+	size_t offset;
+	int size;
+	uint64_t timestamp_ns;
+};
+
+struct burst
+{
+	int frames;
+	char *prefix;
+	int huge;
+
+	uint8_t *arena;
+	size_t arena_size;
+	struct burst_frame *index;
+
+	int state;		/* enum burst_state, atomic */
+	uint64_t trigger_ns;
+	uint64_t first_ns;	/* dequeue of the first frame */
+	int count;
+	size_t used;
+	int truncated;
+	int bursts;
+
+	pthread_t flusher;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int started;
+	int quit;
+
+	char path[108];
+	int fd;
+	int quit_pipe[2];
+	pthread_t listener;
+};
+
+struct burst *burst_new (const char *spec)
+{
+	struct burst *b;
+	char *colon;
+
+	colon = strchr (spec, ':');
+	if (atoi (spec) < 1 || !colon || !colon[1])
+	{
+		fprintf (stderr, "bad burst \"%s\", <frames>:<prefix>[:huge]\n", spec);
+		return NULL;
+	}
+
+	b = calloc (1, sizeof (*b));
+	if (!b)
+		return NULL;
+	b->frames = atoi (spec);
+	b->prefix = strdup (colon + 1);
+	if (!b->prefix)
+	{
+		free (b);
+		return NULL;
+	}
+	b->fd = -1;
+	b->quit_pipe[0] = b->quit_pipe[1] = -1;
+	pthread_mutex_init (&b->lock, NULL);
+	pthread_cond_init (&b->cond, NULL);
+
+	colon = strrchr (b->prefix, ':');
+	if (colon && !strcmp (colon, ":huge"))
+	{
+		*colon = 0;
+		b->huge = 1;
+	}
+
+	return b;
+}
+
+int burst_trigger (struct burst *b)
+{
+	uint64_t now = now_ns ();
+	int idle = BURST_IDLE;
+
+	if (!__atomic_compare_exchange_n (&b->state, &idle, BURST_ARMED, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+		return 0;
+	/* only read by the flush, long after */
+	b->trigger_ns = now;
+
+	return 1;
+}
+
+static void flush (struct burst *b)
+{
+	char *name = NULL;
+	uint64_t start;
+	int fd = -1;
+	FILE *fp = NULL;
+	int i;
+
+	start = now_ns ();
+	if (asprintf (&name, "%s-%03d.raw", b->prefix, b->bursts) > 0)
+		fd = open (name, O_CREAT|O_WRONLY|O_TRUNC, 0644);
+	if (fd < 0 || write_all (fd, b->arena, b->used) < 0)
+		error ("cannot write %s\n", name ? name : b->prefix);
+	if (fd >= 0)
+		close (fd);
+	free (name);
+	name = NULL;
+
+	if (asprintf (&name, "%s-%03d.idx", b->prefix, b->bursts) > 0)
+		fp = fopen (name, "w");
+	if (fp)
+	{
+		for (i = 0; i < b->count; i ++)
+			fprintf (fp, "%zu %d %llu\n", b->index[i].offset, b->index[i].size,
+					(unsigned long long) b->index[i].timestamp_ns);
+		fclose (fp);
+	}
+	free (name);
+
+	fprintf (stderr, "burst %d: %d frames%s, %zu bytes, first frame %.3f ms after the trigger, %.1f ms captured, flushed in %.1f ms\n",
+			b->bursts, b->count, b->truncated ? " (arena full)" : "", b->used,
+			(b->first_ns - b->trigger_ns) / 1e6,
+			b->count > 1 ? (b->index[b->count - 1].timestamp_ns - b->index[0].timestamp_ns) / 1e6 : 0.0,
+			(now_ns () - start) / 1e6);
+	b->bursts ++;
+}
+
+static void *flusher_main (void *arg)
+{
+	struct burst *b = arg;
+
+	rt_sink_thread ();
+
+	pthread_mutex_lock (&b->lock);
+	while (1)
+	{
+		if (__atomic_load_n (&b->state, __ATOMIC_ACQUIRE) == BURST_FLUSHING)
+		{
+			pthread_mutex_unlock (&b->lock);
+			flush (b);
+			pthread_mutex_lock (&b->lock);
+			__atomic_store_n (&b->state, BURST_IDLE, __ATOMIC_RELEASE);
+			continue;
+		}
+		if (b->quit)
+			break;
+		pthread_cond_wait (&b->cond, &b->lock);
+	}
+	pthread_mutex_unlock (&b->lock);
+
+	return NULL;
+}
+
+static void *listener_main (void *arg)
+{
+	struct burst *b = arg;
+
+	rt_sink_thread ();
+
+	while (1)
+	{
+		struct pollfd pfd[2] = {
+			{ .fd = b->fd, .events = POLLIN, },
+			{ .fd = b->quit_pipe[0], .events = POLLIN, },
+		};
+		struct pollfd cfd = { .events = POLLIN, };
+		char cmd[64];
+		ssize_t n;
+
+		if (poll (pfd, 2, -1) < 0 && errno != EINTR)
+			break;
+		if (pfd[1].revents)
+			break;
+		if (!(pfd[0].revents & POLLIN))
+			continue;
+
+		cfd.fd = accept4 (b->fd, NULL, NULL, SOCK_CLOEXEC);
+		if (cfd.fd < 0)
+			continue;
+		n = poll (&cfd, 1, 1000) > 0 ? read (cfd.fd, cmd, sizeof (cmd) - 1) : 0;
+		if (n > 0)
+		{
+			cmd[n] = 0;
+			if (!strncmp (cmd, "burst", 5))
+				dprintf (cfd.fd, burst_trigger (b) ? "ok\n" : "busy\n");
+			else
+				dprintf (cfd.fd, "unknown command, burst\n");
+		}
+		close (cfd.fd);
+	}
+
+	return NULL;
+}
+
+int burst_listen (struct burst *b, const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX, };
+
+	snprintf (b->path, sizeof (b->path), "%s", path);
+	snprintf (addr.sun_path, sizeof (addr.sun_path), "%s", path);
+	b->fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	unlink (b->path);
+	if (b->fd < 0 || bind (b->fd, (struct sockaddr *) &addr, sizeof (addr)) < 0 || listen (b->fd, 4) < 0)
+	{
+		error ("cannot listen on %s\n", path);
+		return -1;
+	}
+	if (pipe2 (b->quit_pipe, O_CLOEXEC) < 0 || pthread_create (&b->listener, NULL, listener_main, b))
+	{
+		error ("cannot start burst listener\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int burst_start (struct stage *st, const struct v4l2_format *fmt)
+{
+	struct burst *b = st->priv;
+
+	b->arena_size = (size_t) b->frames * fmt->fmt.pix.sizeimage;
+	if (!b->arena_size)
+	{
+		fprintf (stderr, "-b: frame size unknown\n");
+		return -1;
+	}
+
+	b->arena = MAP_FAILED;
+	if (b->huge)
+	{
+		size_t size = (b->arena_size + HUGE_PAGE - 1) & ~(size_t) (HUGE_PAGE - 1);
+
+		b->arena = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (b->arena != MAP_FAILED)
+			b->arena_size = size;
+		else
+			fprintf (stderr, "-b: no huge pages reserved, using transparent huge pages\n");
+	}
+	if (b->arena == MAP_FAILED)
+	{
+		b->arena = mmap (NULL, b->arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (b->arena == MAP_FAILED)
+		{
+			error ("cannot map a %zu bytes burst arena\n", b->arena_size);
+			b->arena = NULL;
+			return -1;
+		}
+		if (b->huge)
+			madvise (b->arena, b->arena_size, MADV_HUGEPAGE);
+	}
+
+	/* fault every page in now, and keep it */
+	memset (b->arena, 0, b->arena_size);
+	if (mlock (b->arena, b->arena_size) < 0 && debug_level > 0)
+		printf ("burst arena not locked. %s\n", strerror (errno));
+
+	b->index = calloc (b->frames, sizeof (b->index[0]));
+	if (!b->index)
+		return -1;
+
+	if (pthread_create (&b->flusher, NULL, flusher_main, b))
+	{
+		error ("cannot start burst flusher\n");
+		return -1;
+	}
+	b->started = 1;
+
+	fprintf (stderr, "burst: %d frames, %zu bytes arena%s\n", b->frames, b->arena_size, b->huge ? ", huge pages" : "");
+
+	return 0;
+}
+
+static void end_burst (struct burst *b)
+{
+	__atomic_store_n (&b->state, BURST_FLUSHING, __ATOMIC_RELEASE);
+	pthread_mutex_lock (&b->lock);
+	pthread_cond_signal (&b->cond);
+	pthread_mutex_unlock (&b->lock);
+}
+
+static enum stage_result burst_process (struct stage *st, struct frame *f)
+{
+	struct burst *b = st->priv;
+	struct burst_frame *bf;
+	int state;
+
+	state = __atomic_load_n (&b->state, __ATOMIC_ACQUIRE);
+	if (state == BURST_ARMED)
+	{
+		b->first_ns = now_ns ();
+		b->count = 0;
+		b->used = 0;
+		b->truncated = 0;
+		__atomic_store_n (&b->state, BURST_RECORDING, __ATOMIC_RELAXED);
+	}
+	else if (state != BURST_RECORDING)
+		return STAGE_PASS;
+
+	if (f->size > b->arena_size - b->used)
+	{
+		b->truncated = 1;
+		end_burst (b);
+		return STAGE_PASS;
+	}
+
+	bf = &b->index[b->count ++];
+	bf->offset = b->used;
+	bf->size = f->size;
+	bf->timestamp_ns = f->timestamp_ns;
+	memcpy (b->arena + b->used, f->data, f->size);
+	b->used += f->size;
+
+	if (b->count == b->frames)
+		end_burst (b);
+
+	return STAGE_PASS;
+}
+
+static void burst_stop (struct stage *st)
+{
+	struct burst *b = st->priv;
+
+	if (b->quit_pipe[1] >= 0)
+	{
+		write_all (b->quit_pipe[1], "q", 1);
+		pthread_join (b->listener, NULL);
+		close (b->quit_pipe[0]);
+		close (b->quit_pipe[1]);
+	}
+	if (b->fd >= 0)
+	{
+		close (b->fd);
+		unlink (b->path);
+	}
+
+	if (b->started)
+	{
+		/* write what a running burst has so far */
+		if (__atomic_load_n (&b->state, __ATOMIC_ACQUIRE) == BURST_RECORDING)
+			end_burst (b);
+
+		pthread_mutex_lock (&b->lock);
+		b->quit = 1;
+		pthread_cond_signal (&b->cond);
+		pthread_mutex_unlock (&b->lock);
+		pthread_join (b->flusher, NULL);
+	}
+
+	if (b->arena)
+		munmap (b->arena, b->arena_size);
+	free (b->index);
+	free (b->prefix);
+	pthread_mutex_destroy (&b->lock);
+	pthread_cond_destroy (&b->cond);
+	free (b);
+}
+
+struct stage *burst_stage_new (struct burst *b)
+{
+	struct stage *st;
+
+	st = stage_new ("burst", burst_process, b);
+	if (!st)
+		return NULL;
+	st->start = burst_start;
+	st->stop = burst_stop;
+
+	return st;
+}
@@ -0,0 +1,32 @@
+#ifndef BURST_H
+#define BURST_H
+
+#include "pipeline.h"
+
+/*
+ * Burst capture of the next N frames into memory.
+ *
+ * An arena for N frames of sizeimage is mapped, with huge pages when asked
+ * and available, and written once before stream on so no page faults are
+ * left.  When triggered, the stage copies the following frames into the
+ * arena; nothing but the copy runs in the capture thread.  After the last
+ * frame a flush thread writes <prefix>-<n>.raw and <prefix>-<n>.idx, an
+ * index replay -r index= understands, and the burst can be triggered again.
+ *
+ * spec is "<frames>:<prefix>[:huge]".
+ */
+
+struct burst;
+
+struct burst *burst_new (const char *spec);
+
+/* accept "burst" commands on a unix stream socket */
+int burst_listen (struct burst *b, const char *path);
+
+/* start a burst, returns 0 when one is running already. async signal safe */
+int burst_trigger (struct burst *b);
+
+/* the pipeline owns b afterwards, it is freed when the stage stops */
+struct stage *burst_stage_new (struct burst *b);
+
+#endif
@@ -18,20 +18,17 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <getopt.h>
-
-#define error(fmt,args...)	_error("%s.%d "fmt, __func__, __LINE__, #args)
-void _error (const char *fmt, ...)
-{
-	va_list ap;
-	int en = errno;
-
-	va_start (ap, fmt);
-	vfprintf (stdout, fmt, ap);
-	va_end (ap);
-	fprintf (stdout, "errno %d, %s\n", en, strerror (en));
-}
-
-int debug_level;
+#include <signal.h>
+
+#include "util.h"
+#include "pipeline.h"
+#include "stages.h"
+#include "replay.h"
+#include "metrics.h"
+#include "controls.h"
+#include "burst.h"
+#include "automode.h"
+#include "rt.h"
 
 /* UVC H.264 control selectors */
 
@@ -223,7 +220,18 @@ int print_fmt (struct v4l2_format *fmt)
 	return 0;
 }
 
-int v4l2_capture (const char *name, int width, int height, int fr_num, int fr_den, unsigned int pixel_format, int *running, int (*got_data) (void *arg, void *data, int size), void *got_data_arg)
+/* what the capture loop does besides handing frames to got_frame */
+struct capture_opts
+{
+	int realtime;			/* rt_setup() parameters apply */
+	struct rt_jitter *jitter;
+	struct controls *controls;	/* profiles to apply */
+};
+
+int v4l2_capture (const char *name, int width, int height, int fr_num, int fr_den, unsigned int pixel_format,
+		const struct capture_opts *opts, int *running,
+		int (*got_format) (void *arg, const struct v4l2_format *fmt),
+		int (*got_frame) (void *arg, struct frame *f), void *got_data_arg)
 {
 	struct v4l2_capability caps = { };
 	struct v4l2_format fmt = { };
@@ -232,7 +240,7 @@ int v4l2_capture (const char *name, int width, int height, int fr_num, int fr_de
 	{
 		struct v4l2_buffer vb;
 		void *mem;
-	} bufs[4];
+	} bufs[4] = { };
 #define buf_count (sizeof(bufs) / sizeof(bufs[0]))
 	int fd;
 	int ret;
@@ -272,13 +280,12 @@ int v4l2_capture (const char *name, int width, int height, int fr_num, int fr_de
 	print_fmt (&fmt);
 
 	/* set format */
-	if (width > 0 || pixel_format )
+	if (width > 0 || height > 0 || pixel_format)
 	{
 		if (width > 0)
-		{
 			fmt.fmt.pix.width = width;
-			fmt.fmt.pix.height = width;
-		}
+		if (height > 0)
+			fmt.fmt.pix.height = height;
 		if (pixel_format)
 			fmt.fmt.pix.pixelformat = pixel_format;
 		fmt.fmt.pix.field = V4L2_FIELD_ANY;
@@ -302,6 +309,39 @@ int v4l2_capture (const char *name, int width, int height, int fr_num, int fr_de
 		print_fmt (&fmt);
 	}
 
+	/* set frame interval */
+	if (fr_num > 0 && fr_den > 0)
+	{
+		struct v4l2_streamparm param = { };
+
+		param.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		param.parm.capture.timeperframe.numerator = fr_num;
+		param.parm.capture.timeperframe.denominator = fr_den;
+		ret = ioctl (fd, VIDIOC_S_PARM, &param);
+		if (ret < 0)
+		{
+			error ("VIDIOC_S_PARM failed.\n");
+			goto done;
+		}
+		fprintf (stderr, "timeperframe %d/%d\n",
+				param.parm.capture.timeperframe.numerator,
+				param.parm.capture.timeperframe.denominator);
+	}
+
+	if (got_format)
+	{
+		ret = got_format (got_data_arg, &fmt);
+		if (ret < 0)
+			goto done;
+	}
+
+	if (opts->controls)
+	{
+		ret = controls_start (opts->controls, fd, &fmt);
+		if (ret < 0)
+			goto done;
+	}
+
 	/* request buffer and map */
 	reqbufs.count = buf_count;
 	reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -335,6 +375,8 @@ int v4l2_capture (const char *name, int width, int height, int fr_num, int fr_de
 			goto done;
 		}
 		fprintf (stderr, "bufs[%d].mem %p\n", i, bufs[i].mem);
+		if (opts->realtime)
+			rt_prefault (bufs[i].mem, bufs[i].vb.length);
 
 		if (!(bufs[i].vb.flags & V4L2_BUF_FLAG_QUEUED))
 		{
@@ -347,6 +389,9 @@ int v4l2_capture (const char *name, int width, int height, int fr_num, int fr_de
 		}
 	}
 
+	if (opts->realtime)
+		rt_capture_thread ();
+
 	/* stream on */
 	ret = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	ret = ioctl (fd, VIDIOC_STREAMON, &ret);
@@ -359,17 +404,31 @@ int v4l2_capture (const char *name, int width, int height, int fr_num, int fr_de
 	while (*running)
 	{
 		struct v4l2_buffer vb;
+		struct frame f = { };
 
 		/* dequeue */
 		memset (&vb, 0, sizeof (vb));
 		vb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 		ret = ioctl (fd, VIDIOC_DQBUF, &vb);
+		if (ret < 0 && errno == EINTR)
+			continue;
 		if (ret < 0)
 		{
 			error ("VIDIOC_DQBUF failed.\n");
 			goto done;
 		}
 
+		f.data = bufs[vb.index].mem;
+		f.size = vb.bytesused;
+		f.sequence = vb.sequence;
+		f.flags = vb.flags;
+		f.timestamp_ns = 0;
+		if ((vb.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+			f.timestamp_ns = vb.timestamp.tv_sec * 1000000000ull + vb.timestamp.tv_usec * 1000ull;
+
+		if (opts->jitter)
+			rt_jitter_add (opts->jitter, now_ns (), f.timestamp_ns, vb.sequence);
+
 		if (debug_level > 0)
 		{
 			char str[3*8 + 1];
@@ -379,7 +438,9 @@ int v4l2_capture (const char *name, int width, int height, int fr_num, int fr_de
 			fprintf (stderr, "%4d. bufs[%d] flags 0x%x, bytes %6d, field %d, seq %5d, data:%s\n",
 					frame_count, vb.index, vb.flags, vb.bytesused, vb.field, vb.sequence, str);
 		}
-		got_data (got_data_arg, bufs[vb.index].mem, vb.bytesused);
+		got_frame (got_data_arg, &f);
+		if (opts->controls)
+			controls_frame (opts->controls, fd, frame_count, &f);
 
 		ret = ioctl (fd, VIDIOC_QBUF, &vb);
 		if (ret < 0)
@@ -401,125 +462,134 @@ int v4l2_capture (const char *name, int width, int height, int fr_num, int fr_de
 	}
 
 done:
+	for (i=0; i<buf_count; i++)
+		if (bufs[i].mem && bufs[i].mem != MAP_FAILED)
+			munmap (bufs[i].mem, bufs[i].vb.length);
 	close (fd);
 	return ret;
 }
 
-struct got_data_arg
+int got_format (void *arg, const struct v4l2_format *fmt)
 {
-	int outfd;
-	int dump_level;
-	char *single_out;
-};
-
-int opt_skip_frames;
-int current_skip_count;
+	return pipeline_start (arg, fmt);
+}
 
-int got_data (void *arg, void *data, int size)
+int got_frame (void *arg, struct frame *f)
 {
-	struct got_data_arg *gd_arg = arg;
+	pipeline_run (arg, f);
 
-	if (opt_skip_frames > 0)
-	{
-		current_skip_count ++;
-		if (current_skip_count < opt_skip_frames)
-		{
-			if (debug_level > 0)
-				printf ("skip.   %d/%d\n", current_skip_count, opt_skip_frames);
+	return 0;
+}
 
-			return 0;
-		}
+static int running = 1;
 
-		if (debug_level > 0)
-			printf ("handle. %d/%d\n", current_skip_count, opt_skip_frames);
-		current_skip_count = 0;
-	}
+static void stop_running (int sig)
+{
+	running = 0;
+}
 
-	if (gd_arg->dump_level > 0)
-	{
-		int offs;
-		int zeros;
-		unsigned char *p;
-		bool got_start;
-
-		zeros = 0;
-		p = data;
-		got_start = false;
-		for (offs = 0, p = data; (void *)p < data + size; p ++, offs ++)
-		{
-			if (got_start)
-			{
-				unsigned char *t = p - zeros;
+static struct burst *burst;
 
-				printf ("%02x %02x %02x %02x %02x %02x %02x %02x - NAL type %2d at offs %d\n",
-						t[0], t[1], t[2], t[3], t[4], t[5], t[6], t[7],
-						*p & 0x1f, offs);
-				got_start = false;
-				zeros = 0;
-			}
-			else
-			{
-				if (*p == 0)
-					zeros ++;
-				else if (zeros > 2 && *p == 0x01)
-					got_start = true;
-				else
-					zeros = 0;
-			}
-		}
-	}
+/* -g mode verification */
 
-	if (gd_arg->outfd >= 0)
-	{
-		write (gd_arg->outfd, data, size);
-	}
+struct measure
+{
+	int frames;
+	int target;
+	uint64_t first_ns;
+	uint64_t last_ns;
+};
 
-	if (gd_arg->single_out)
-	{
-		char *tmp_fname = NULL;
+#define MEASURE_WARMUP	5	/* frames not counted, cameras settle first */
 
-		asprintf (&tmp_fname, "%s.tmp", gd_arg->single_out);
-		if (tmp_fname)
-		{
-			int out;
+static int measuring;
 
-			out = open (tmp_fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-			if (out)
-			{
-				ssize_t written;
-
-				written = write (out, data, size);
-				if (debug_level > 0)
-					printf ("%zd written\n", written);
-				close (out);
-				if (rename (tmp_fname, gd_arg->single_out) < 0)
-					error ("rename() failed. %s(%d)\n", strerror(errno), errno);
-			}
-			else
-				error ("open(%s) failed. %s(%d)\n", tmp_fname, strerror(errno), errno);
+static void stop_measuring (int sig)
+{
+	measuring = 0;
+}
 
-			free (tmp_fname);
-		}
-	}
+static int measure_frame (void *arg, struct frame *f)
+{
+	struct measure *m = arg;
+	uint64_t ts = f->timestamp_ns ? f->timestamp_ns : now_ns ();
+
+	if (m->frames ++ == MEASURE_WARMUP)
+		m->first_ns = ts;
+	m->last_ns = ts;
+	if (m->frames >= m->target || !running)
+		measuring = 0;
 
 	return 0;
 }
 
+static double measure_mode (void *arg, const struct auto_mode *mode)
+{
+	const char *device = arg;
+	struct sigaction sa = { .sa_handler = stop_measuring, };
+	/* probes only measure. no controls, no real-time setup, threads started later would inherit it */
+	struct capture_opts opts = { };
+	struct measure m = { };
+	int fps = mode->fr_den / mode->fr_num;
+
+	/* about a second of frames, and no more than three seconds */
+	m.target = MEASURE_WARMUP + (fps > 10 ? fps : 10);
+	measuring = 1;
+	sigaction (SIGALRM, &sa, NULL);
+	alarm (3);
+	v4l2_capture (device, mode->width, mode->height, mode->fr_num, mode->fr_den, mode->pixelformat,
+			&opts, &measuring, NULL, measure_frame, &m);
+	alarm (0);
+	if (!running)
+		return -1;
+
+	if (m.frames <= MEASURE_WARMUP + 1 || m.last_ns <= m.first_ns)
+		return 0;
+
+	return (m.frames - MEASURE_WARMUP - 1) * 1e9 / (m.last_ns - m.first_ns);
+}
+
+static void start_burst (int sig)
+{
+	burst_trigger (burst);
+}
+
 int main (int argc, char **argv)
 {
 	char *opt_device = "/dev/video0";
 	char *opt_output = NULL;
-	struct got_data_arg gd_arg = { };
+	char *opt_single_out = NULL;
+	char *opt_index = NULL;
+	char *opt_replay = NULL;
+	struct replay_params replay_params = REPLAY_PARAMS_DEFAULT;
+	int opt_dump_level = 0;
+	int opt_skip_frames = 0;
+	int opt_compress_threads = 0;
+	struct previews *previews = NULL;
+	struct motion_params *opt_motion = NULL;
+	struct pipeline pipeline = { };
+	struct metrics *metrics = NULL;
+	char *opt_metrics = NULL;
+	char *opt_decimate = NULL;
 	int opt_width = -1;
 	int opt_height = -1;
 	unsigned int opt_pixelformat = 0;
-	int running = 1;
+	struct motion_params motion_params = MOTION_PARAMS_DEFAULT;
+	struct rt_params rt_params = { };
+	struct sigaction sa = { .sa_handler = stop_running, };
+	struct sigaction sa_burst = { .sa_handler = start_burst, };
+	char *opt_burst_socket = NULL;
+	int opt_fr_num = -1;
+	int opt_fr_den = -1;
+	struct auto_goal goal = AUTO_GOAL_DEFAULT;
+	int opt_auto = 0;
+	struct capture_opts capture_opts = { };
 
 	while (1)
 	{
 		int opt;
 
-		opt = getopt (argc, argv, "?d:w:h:f:o:s:x:k:D");
+		opt = getopt (argc, argv, "?d:i:r:w:h:f:F:g:o:I:s:x:k:K:z:p:m:a:A:P:LJ:M:c:C:b:B:D");
 		if (opt < 0)
 			break;
 
@@ -530,13 +600,32 @@ int main (int argc, char **argv)
 					" $ capture <options>\n"
 					"options:\n"
 					" -d <devname>        : v4l2 device name. default:%s\n"
+					" -i <filename>       : replay a recorded -o stream instead of the device\n"
+					" -r <options>        : replay options. index=<file>,size=<bytes>,rate=<x, 0 for max>,fps=<n>,loop=<n, 0 for ever>\n"
 					" -w <width>          : width of captured screen\n"
-					" -w <height>         : height of captured screen\n"
+					" -h <height>         : height of captured screen\n"
 					" -f <pixelformat>    : pixel format\n"
+					" -F <fps>            : frame rate, or frame interval <num>/<den> seconds\n"
+					" -g <goal>           : choose format, size and rate. w=<min>,h=<min>,fps=<min>,h264,bw=<MB/s>,cache=<file>,tries=<n>\n"
 					" -o <filename>       : filename of pixel dump\n"
+					" -I <filename>       : write a frame index of -o for replay\n"
 					" -s <filename>       : filename of pixel dump. keeps one recent frame\n"
 					" -x <dump level>     : console stream dump level\n"
 					" -k <frame skip count> : 0 or 1 for no skip. 5 for 4 frames skip in 5 frames\n"
+					" -K <mode>           : drop H.264 frames without breaking decoding. nonref, idr or gop=<n>\n"
+					" -z <threads>        : losslessly compress -o output with yuvz using <threads> workers\n"
+					" -p <w>x<h>:<sink>:<path> : downscaled preview, down to 1/256. sink is file, shm or unix. repeatable\n"
+					" -m <options>        : record -o only on motion. thresh=<n>,blocks=<n>,pre=<frames>,post=<frames>\n"
+					" -a <cpus>           : pin the capture thread, \"2\" or \"0,2-3\"\n"
+					" -A <cpus>           : pin sink threads\n"
+					" -P <policy>         : capture thread policy. fifo:<prio>, rr:<prio> or deadline:<runtime us>:<period us>, deadline not with -a\n"
+					" -L                  : lock memory and prefault buffers before stream on\n"
+					" -J <frames>         : measure delivery jitter of <frames> frames, report at exit\n"
+					" -c <filename>       : camera control profiles\n"
+					" -C <profile>[@<frame>] : apply a -c profile before stream on, or at <frame>. repeatable\n"
+					" -b <frames>:<prefix>[:huge] : on SIGUSR1 copy the next <frames> frames to memory, then write <prefix>-<n>.raw/.idx\n"
+					" -B <path>           : also start a burst on \"burst\" sent to unix socket <path>\n"
+					" -M <endpoint>       : serve Prometheus metrics on unix:<path> or http:<port> (127.0.0.1)\n"
 					" -D                  : increase debug level\n"
 					, opt_device);
 				exit (1);
@@ -545,6 +634,15 @@ int main (int argc, char **argv)
 				opt_device = optarg;
 				break;
 
+			case 'i':
+				opt_replay = optarg;
+				break;
+
+			case 'r':
+				if (replay_parse (&replay_params, optarg) < 0)
+					exit (1);
+				break;
+
 			case 'w':
 				opt_width = atoi (optarg);
 				break;
@@ -562,40 +660,252 @@ int main (int argc, char **argv)
 				opt_pixelformat = v4l2_fourcc (optarg[0], optarg[1], optarg[2], optarg[3]);
 				break;
 
+			case 'F':
+				if (strchr (optarg, '/'))
+				{
+					opt_fr_num = atoi (optarg);
+					opt_fr_den = atoi (strchr (optarg, '/') + 1);
+				}
+				else
+				{
+					opt_fr_num = 1;
+					opt_fr_den = atoi (optarg);
+				}
+				if (opt_fr_num <= 0 || opt_fr_den <= 0)
+				{
+					fprintf (stderr, "-F requires <fps> or <num>/<den>\n");
+					exit (1);
+				}
+				break;
+
+			case 'g':
+				if (auto_parse (&goal, optarg) < 0)
+					exit (1);
+				opt_auto = 1;
+				break;
+
 			case 'o':
 				opt_output = optarg;
 				break;
 
+			case 'I':
+				opt_index = optarg;
+				break;
+
 			case 's':
-				gd_arg.single_out = optarg;
+				opt_single_out = optarg;
 				break;
 
 			case 'x':
-				gd_arg.dump_level = atoi (optarg);
+				opt_dump_level = atoi (optarg);
 				break;
 
 			case 'k':
 				opt_skip_frames = atoi (optarg);
 				break;
 
+			case 'K':
+				opt_decimate = optarg;
+				break;
+
+			case 'z':
+				opt_compress_threads = atoi (optarg);
+				break;
+
+			case 'p':
+				if (previews_add (&previews, optarg) < 0)
+					exit (1);
+				break;
+
+			case 'm':
+				if (motion_parse (&motion_params, optarg) < 0)
+					exit (1);
+				opt_motion = &motion_params;
+				break;
+
+			case 'a':
+				rt_params.capture_cpus = optarg;
+				capture_opts.realtime = 1;
+				break;
+
+			case 'A':
+				rt_params.sink_cpus = optarg;
+				capture_opts.realtime = 1;
+				break;
+
+			case 'P':
+				if (rt_parse_policy (&rt_params, optarg) < 0)
+					exit (1);
+				capture_opts.realtime = 1;
+				break;
+
+			case 'L':
+				rt_params.lock_memory = 1;
+				capture_opts.realtime = 1;
+				break;
+
+			case 'J':
+				/* intervals need two frames at least */
+				if (atoi (optarg) >= 2)
+					capture_opts.jitter = rt_jitter_new (atoi (optarg));
+				if (!capture_opts.jitter)
+				{
+					fprintf (stderr, "-J requires a frame count\n");
+					exit (1);
+				}
+				break;
+
+			case 'c':
+				capture_opts.controls = controls_load (optarg);
+				if (!capture_opts.controls)
+					exit (1);
+				break;
+
+			case 'C':
+				if (!capture_opts.controls)
+				{
+					fprintf (stderr, "-C needs -c before it\n");
+					exit (1);
+				}
+				if (controls_schedule (capture_opts.controls, optarg) < 0)
+					exit (1);
+				break;
+
+			case 'b':
+				burst = burst_new (optarg);
+				if (!burst)
+					exit (1);
+				break;
+
+			case 'B':
+				opt_burst_socket = optarg;
+				break;
+
+			case 'M':
+				opt_metrics = optarg;
+				break;
+
 			case 'D':
 				debug_level ++;
 				break;
 		}
 	}
 
-	gd_arg.outfd = -1;
+	if (opt_auto && (opt_replay || opt_width > 0 || opt_height > 0 || opt_pixelformat || opt_fr_num > 0))
+	{
+		fprintf (stderr, "-g chooses the mode itself, it does not go with -i, -w, -h, -f or -F\n");
+		exit (1);
+	}
+
+	if (rt_setup (&rt_params) < 0)
+		exit (1);
+
+	/* filters, taps, the gate, then the sink. metrics see every frame */
+	if (opt_metrics)
+	{
+		metrics = metrics_new (opt_metrics, &pipeline);
+		if (!metrics || pipeline_add (&pipeline, metrics_stage_new (metrics)) < 0)
+			exit (1);
+	}
+	if (burst)
+	{
+		if (opt_burst_socket && burst_listen (burst, opt_burst_socket) < 0)
+			exit (1);
+		if (pipeline_add (&pipeline, burst_stage_new (burst)) < 0)
+			exit (1);
+	}
+	else if (opt_burst_socket)
+	{
+		fprintf (stderr, "-B needs -b\n");
+		exit (1);
+	}
+	if (opt_skip_frames > 1 && pipeline_add (&pipeline, skip_stage_new (opt_skip_frames)) < 0)
+		exit (1);
+	if (opt_decimate && pipeline_add (&pipeline, decimate_stage_new (opt_decimate)) < 0)
+		exit (1);
+	if (previews && pipeline_add (&pipeline, preview_stage_new (previews)) < 0)
+		exit (1);
+	if (opt_dump_level > 0 && pipeline_add (&pipeline, dump_stage_new (opt_dump_level)) < 0)
+		exit (1);
+	if (opt_single_out && pipeline_add (&pipeline, single_stage_new (opt_single_out)) < 0)
+		exit (1);
+	if (opt_index && (!opt_output || opt_compress_threads > 0))
+	{
+		fprintf (stderr, "-I needs -o without -z, yuvz streams are indexed by themselves\n");
+		exit (1);
+	}
+	if (opt_motion && !opt_output)
+	{
+		fprintf (stderr, "-m needs -o\n");
+		exit (1);
+	}
+
 	if (opt_output)
 	{
-		gd_arg.outfd = open (opt_output, O_CREAT|O_WRONLY|O_TRUNC, 0644);
-		if (gd_arg.outfd < 0)
+		int outfd;
+		int indexfd = -1;
+
+		outfd = open (opt_output, O_CREAT|O_WRONLY|O_TRUNC, 0644);
+		if (outfd < 0)
 		{
 			error ("cannot open %s\n", opt_output);
 			exit (1);
 		}
+		if (opt_index)
+		{
+			indexfd = open (opt_index, O_CREAT|O_WRONLY|O_TRUNC, 0644);
+			if (indexfd < 0)
+			{
+				error ("cannot open %s\n", opt_index);
+				exit (1);
+			}
+		}
+		if (opt_motion && pipeline_add (&pipeline, motion_stage_new (opt_motion)) < 0)
+			exit (1);
+		if (pipeline_add (&pipeline, record_stage_new (outfd, opt_compress_threads, indexfd)) < 0)
+			exit (1);
 	}
 
-	v4l2_capture (opt_device, opt_width, opt_height, -1, -1, opt_pixelformat, &running, got_data, &gd_arg);
+	/* let SIGINT interrupt VIDIOC_DQBUF so pending output is flushed */
+	sigaction (SIGINT, &sa, NULL);
+	sigaction (SIGTERM, &sa, NULL);
+	if (burst)
+		sigaction (SIGUSR1, &sa_burst, NULL);
+
+	if (opt_auto)
+	{
+		struct auto_mode mode;
+
+		if (auto_select (opt_device, &goal, measure_mode, opt_device, &mode) < 0)
+			running = 0;
+		else
+		{
+			opt_pixelformat = mode.pixelformat;
+			opt_width = mode.width;
+			opt_height = mode.height;
+			opt_fr_num = mode.fr_num;
+			opt_fr_den = mode.fr_den;
+		}
+	}
+
+	if (opt_replay)
+	{
+		replay_params.pixelformat = opt_pixelformat;
+		replay_params.width = opt_width;
+		replay_params.height = opt_height;
+		replay_capture (opt_replay, &replay_params, &running, got_format, got_frame, &pipeline);
+	}
+	else if (running)
+		v4l2_capture (opt_device, opt_width, opt_height, opt_fr_num, opt_fr_den, opt_pixelformat,
+				&capture_opts, &running, got_format, got_frame, &pipeline);
+
+	rt_jitter_report (capture_opts.jitter);
+	rt_jitter_free (capture_opts.jitter);
+
+	metrics_close (metrics);
+	signal (SIGUSR1, SIG_IGN);
+	pipeline_stop (&pipeline);
+	controls_close (capture_opts.controls);
 
 	return 0;
 }
@@ -0,0 +1,468 @@
+#define _GNU_SOURCE
+
+#include <sys/ioctl.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "util.h"
+#include "controls.h"
+
+#define MAX_PROFILES		16
+#define MAX_SCHEDULE		32
+#define SETTLE_FRAMES		120	/* give up looking for a changed frame */
+
+struct setting
+{
+	char *name;
+	long long value;
+};
+
+struct profile
+{
+	char *name;
+	struct setting *settings;
+	int count;
+	struct v4l2_ext_control *ctrls;
+};
+
+struct change
+{
+	struct profile *profile;
+	int frame;		/* -1 before stream on */
+
+	/* measured */
+	int applied;
+	uint64_t apply_ns;	/* start of VIDIOC_S_EXT_CTRLS */
+	uint64_t ioctl_ns;
+	uint64_t first_ns;	/* first frame captured after it */
+	uint64_t changed_ns;	/* first frame with a different mean luma */
+	int changed_frames;
+	int failed;
+};
+
+struct controls
+{
+	struct profile profiles[MAX_PROFILES];
+	int nprofiles;
+	struct change schedule[MAX_SCHEDULE];
+	int nschedule;
+
+	/* luma sampling of raw formats */
+	int luma_step;
+	int bytesperline;
+	int width;
+	int height;
+	int sizeimage;
+	int last_mean;
+
+	struct change *pending;
+	int pending_mean;
+	int pending_frames;
+};
+
+void controls_name (char *dst, size_t size, const char *name)
+{
+	size_t n = 0;
+	int sep = 0;
+
+	for (; *name && n + 1 < size; name ++)
+	{
+		if (isalnum ((unsigned char) *name))
+		{
+			if (sep && n)
+				dst[n ++] = '_';
+			if (n + 1 < size)
+				dst[n ++] = tolower ((unsigned char) *name);
+			sep = 0;
+		}
+		else
+			sep = 1;
+	}
+	dst[n] = 0;
+}
+
+static char *trim (char *s)
+{
+	char *e;
+
+	while (isspace ((unsigned char) *s))
+		s ++;
+	e = s + strlen (s);
+	while (e > s && isspace ((unsigned char) e[-1]))
+		e --;
+	*e = 0;
+
+	return s;
+}
+
+struct controls *controls_load (const char *filename)
+{
+	struct controls *c;
+	struct profile *p = NULL;
+	char *line = NULL;
+	size_t len = 0;
+	int lineno = 0;
+	FILE *fp;
+
+	fp = fopen (filename, "r");
+	if (!fp)
+	{
+		error ("cannot open %s\n", filename);
+		return NULL;
+	}
+
+	c = calloc (1, sizeof (*c));
+	if (!c)
+		goto done;
+
+	while (getline (&line, &len, fp) > 0)
+	{
+		char *s, *eq, *end;
+
+		lineno ++;
+		s = strchr (line, '#');
+		if (s)
+			*s = 0;
+		s = trim (line);
+		if (!*s)
+			continue;
+
+		if (*s == '[')
+		{
+			char *e = strchr (s, ']');
+
+			if (!e || c->nprofiles == MAX_PROFILES)
+			{
+				fprintf (stderr, "%s:%d: %s\n", filename, lineno, e ? "too many profiles" : "bad profile");
+				goto fail;
+			}
+			*e = 0;
+			p = &c->profiles[c->nprofiles ++];
+			p->name = strdup (trim (s + 1));
+			continue;
+		}
+
+		eq = strchr (s, '=');
+		if (!p || !eq)
+		{
+			fprintf (stderr, "%s:%d: expected [profile] or <control> = <value>\n", filename, lineno);
+			goto fail;
+		}
+		*eq = 0;
+
+		{
+			struct setting *set;
+			char *v = trim (eq + 1);
+			long long value;
+
+			value = strtoll (v, &end, 0);
+			if (end == v || *end)
+			{
+				fprintf (stderr, "%s:%d: bad value\n", filename, lineno);
+				goto fail;
+			}
+
+			set = realloc (p->settings, (p->count + 1) * sizeof (p->settings[0]));
+			if (!set)
+				goto fail;
+			p->settings = set;
+			set = &p->settings[p->count ++];
+			memset (set, 0, sizeof (*set));
+			set->name = strdup (trim (s));
+			set->value = value;
+		}
+	}
+	goto done;
+
+fail:
+	/* a half read profile would apply the wrong controls */
+	controls_close (c);
+	c = NULL;
+
+done:
+	free (line);
+	fclose (fp);
+	return c;
+}
+
+int controls_schedule (struct controls *c, const char *spec)
+{
+	char name[64];
+	const char *at;
+	struct change *ch;
+	int i;
+
+	at = strchr (spec, '@');
+	snprintf (name, sizeof (name), "%.*s", at ? (int) (at - spec) : (int) strlen (spec), spec);
+
+	if (c->nschedule == MAX_SCHEDULE)
+	{
+		fprintf (stderr, "too many profile switches\n");
+		return -1;
+	}
+	ch = &c->schedule[c->nschedule];
+	ch->frame = at ? atoi (at + 1) : -1;
+
+	for (i = 0; i < c->nprofiles; i ++)
+	{
+		if (!strcmp (c->profiles[i].name, name))
+		{
+			ch->profile = &c->profiles[i];
+			c->nschedule ++;
+			return 0;
+		}
+	}
+
+	fprintf (stderr, "no control profile [%s]\n", name);
+	return -1;
+}
+
+/* look up the control ids and types of a profile */
+static int resolve (struct profile *p, int fd)
+{
+	int i;
+
+	if (p->ctrls)
+		return 0;
+
+	p->ctrls = calloc (p->count, sizeof (p->ctrls[0]));
+	if (!p->ctrls)
+		return -1;
+
+	for (i = 0; i < p->count; i ++)
+	{
+		struct setting *set = &p->settings[i];
+		struct v4l2_query_ext_ctrl q = { };
+		char *end;
+		int found = 0;
+
+		q.id = strtoul (set->name, &end, 0);
+		if (*end == 0 && q.id)
+			found = ioctl (fd, VIDIOC_QUERY_EXT_CTRL, &q) == 0;
+		else
+		{
+			char name[sizeof (q.name)];
+
+			q.id = V4L2_CTRL_FLAG_NEXT_CTRL;
+			while (ioctl (fd, VIDIOC_QUERY_EXT_CTRL, &q) == 0)
+			{
+				controls_name (name, sizeof (name), q.name);
+				if (!strcmp (name, set->name))
+				{
+					found = 1;
+					break;
+				}
+				q.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
+			}
+		}
+		if (!found)
+		{
+			fprintf (stderr, "[%s] %s: no such control\n", p->name, set->name);
+			return -1;
+		}
+		if (q.flags & V4L2_CTRL_FLAG_HAS_PAYLOAD)
+		{
+			fprintf (stderr, "[%s] %s: compound controls are not supported\n", p->name, set->name);
+			return -1;
+		}
+
+		p->ctrls[i].id = q.id;
+		if (q.type == V4L2_CTRL_TYPE_INTEGER64)
+			p->ctrls[i].value64 = set->value;
+		else
+			p->ctrls[i].value = set->value;
+	}
+
+	return 0;
+}
+
+static int ext_ctrls (struct profile *p, int fd, unsigned long request)
+{
+	struct v4l2_ext_controls ec = { };
+
+	ec.which = V4L2_CTRL_WHICH_CUR_VAL;
+	ec.count = p->count;
+	ec.controls = p->ctrls;
+	if (ioctl (fd, request, &ec) < 0)
+	{
+		if (ec.error_idx < ec.count)
+			error ("[%s] %s %s rejected\n", p->name,
+					request == VIDIOC_TRY_EXT_CTRLS ? "VIDIOC_TRY_EXT_CTRLS" : "VIDIOC_S_EXT_CTRLS",
+					p->settings[ec.error_idx].name);
+		else
+			error ("[%s] %s failed\n", p->name,
+					request == VIDIOC_TRY_EXT_CTRLS ? "VIDIOC_TRY_EXT_CTRLS" : "VIDIOC_S_EXT_CTRLS");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void apply (struct controls *c, struct change *ch, int fd)
+{
+	uint64_t start;
+
+	start = now_ns ();
+	ch->failed = ext_ctrls (ch->profile, fd, VIDIOC_S_EXT_CTRLS) < 0;
+	ch->apply_ns = start;
+	ch->ioctl_ns = now_ns () - start;
+	ch->applied = 1;
+
+	if (!ch->failed && ch->frame >= 0)
+	{
+		c->pending = ch;
+		c->pending_mean = c->last_mean;
+		c->pending_frames = 0;
+	}
+}
+
+int controls_start (struct controls *c, int fd, const struct v4l2_format *fmt)
+{
+	int i;
+
+	switch (fmt->fmt.pix.pixelformat)
+	{
+		case V4L2_PIX_FMT_YUYV:
+			c->luma_step = 2;
+			break;
+		case V4L2_PIX_FMT_GREY:
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_NV12:
+			c->luma_step = 1;
+			break;
+	}
+	c->bytesperline = fmt->fmt.pix.bytesperline;
+	c->width = fmt->fmt.pix.width;
+	c->height = fmt->fmt.pix.height;
+	c->sizeimage = fmt->fmt.pix.sizeimage;
+	c->last_mean = -1;
+
+	for (i = 0; i < c->nschedule; i ++)
+	{
+		struct profile *p = c->schedule[i].profile;
+
+		if (resolve (p, fd) < 0 || ext_ctrls (p, fd, VIDIOC_TRY_EXT_CTRLS) < 0)
+			return -1;
+	}
+
+	for (i = 0; i < c->nschedule; i ++)
+	{
+		struct change *ch = &c->schedule[i];
+
+		if (ch->frame < 0)
+		{
+			apply (c, ch, fd);
+			if (ch->failed)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* mean luma of every 16th sample of every 16th row, -1 for other formats */
+static int mean_luma (struct controls *c, const struct frame *f)
+{
+	const uint8_t *data = f->data;
+	unsigned long sum = 0;
+	unsigned long n = 0;
+	int x, y;
+
+	if (!c->luma_step || f->size < c->sizeimage)
+		return -1;
+
+	for (y = 0; y < c->height; y += 16)
+	{
+		const uint8_t *row = data + (size_t) y * c->bytesperline;
+
+		for (x = 0; x < c->width; x += 16)
+			sum += row[x * c->luma_step];
+		n += (c->width + 15) / 16;
+	}
+
+	return n ? sum / n : -1;
+}
+
+void controls_frame (struct controls *c, int fd, int frame_count, const struct frame *f)
+{
+	struct change *ch = c->pending;
+	int mean;
+	int i;
+
+	mean = mean_luma (c, f);
+
+	if (ch)
+	{
+		if (!ch->first_ns && f->timestamp_ns > ch->apply_ns)
+			ch->first_ns = f->timestamp_ns;
+
+		if (ch->first_ns)
+			c->pending_frames ++;
+		if (mean < 0 || c->pending_mean < 0)
+			c->pending = NULL;
+		else if (abs (mean - c->pending_mean) > 2 + c->pending_mean / 32)
+		{
+			ch->changed_ns = f->timestamp_ns;
+			ch->changed_frames = c->pending_frames;
+			c->pending = NULL;
+		}
+		else if (c->pending_frames > SETTLE_FRAMES)
+			c->pending = NULL;
+	}
+	c->last_mean = mean;
+
+	for (i = 0; i < c->nschedule; i ++)
+		if (c->schedule[i].frame == frame_count && !c->schedule[i].applied)
+			apply (c, &c->schedule[i], fd);
+}
+
+void controls_close (struct controls *c)
+{
+	int i;
+
+	if (!c)
+		return;
+
+	for (i = 0; i < c->nschedule; i ++)
+	{
+		struct change *ch = &c->schedule[i];
+
+		if (!ch->applied)
+			continue;
+
+		fprintf (stderr, "controls: [%s] ", ch->profile->name);
+		if (ch->frame < 0)
+			fprintf (stderr, "before stream on");
+		else
+			fprintf (stderr, "at frame %d", ch->frame);
+		if (ch->failed)
+		{
+			fprintf (stderr, " failed\n");
+			continue;
+		}
+		fprintf (stderr, ", %d controls in %.3f ms", ch->profile->count, ch->ioctl_ns / 1e6);
+		if (ch->first_ns)
+			fprintf (stderr, ", next frame %.1f ms", (ch->first_ns - ch->apply_ns) / 1e6);
+		if (ch->changed_ns)
+			fprintf (stderr, ", changed after %d frames %.1f ms", ch->changed_frames, (ch->changed_ns - ch->apply_ns) / 1e6);
+		else if (ch->frame >= 0 && c->luma_step)
+			fprintf (stderr, ", no visible change");
+		fprintf (stderr, "\n");
+	}
+
+	for (i = 0; i < c->nprofiles; i ++)
+	{
+		struct profile *p = &c->profiles[i];
+		int j;
+
+		for (j = 0; j < p->count; j ++)
+			free (p->settings[j].name);
+		free (p->settings);
+		free (p->ctrls);
+		free (p->name);
+	}
+	free (c);
+}
@@ -0,0 +1,52 @@
+#ifndef CONTROLS_H
+#define CONTROLS_H
+
+#include <linux/videodev2.h>
+
+#include <stddef.h>
+
+#include "pipeline.h"
+
+/*
+ * Camera control profiles.
+ *
+ * A profile file holds named sections of controls,
+ *
+ *   # comment
+ *   [night]
+ *   auto_exposure = 1
+ *   exposure_time_absolute = 1000
+ *   0x00980913 = 100
+ *
+ * Controls are named as desc prints them (lower case, words joined by '_')
+ * or given by id.  A profile is applied in one VIDIOC_S_EXT_CTRLS batch so
+ * the driver changes them together, after VIDIOC_TRY_EXT_CTRLS checked it.
+ *
+ * Profiles are scheduled as "<name>" for before stream on, or
+ * "<name>@<frame>" to switch while streaming.  Every scheduled profile is
+ * checked with VIDIOC_TRY_EXT_CTRLS before stream on.  After a switch the
+ * first frame captured later and, for raw formats, the first frame whose
+ * mean luma moved are timed.
+ */
+
+struct controls;
+
+/* NULL when the file can not be read or has an error */
+struct controls *controls_load (const char *filename);
+
+/* "<name>" or "<name>@<frame>", returns -1 on an unknown profile */
+int controls_schedule (struct controls *c, const char *spec);
+
+/* resolve and try every scheduled profile, apply those for before stream on */
+int controls_start (struct controls *c, int fd, const struct v4l2_format *fmt);
+
+/* apply profiles due at frame_count and time the switch */
+void controls_frame (struct controls *c, int fd, int frame_count, const struct frame *f);
+
+/* print the switch latencies and free */
+void controls_close (struct controls *c);
+
+/* control name as used in profiles, "Exposure, Absolute" is exposure_absolute */
+void controls_name (char *dst, size_t size, const char *name);
+
+#endif
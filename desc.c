@@ -11,6 +11,8 @@
 #include <errno.h>
 #include <stdlib.h>
 
+#include "controls.h"
+
 void error (const char *fmt, ...)
 {
 	va_list ap;
@@ -145,6 +147,93 @@ int desc_fmt (int fd, enum v4l2_buf_type type)
 	return 0;
 }
 
+int desc_ctrls (int fd)
+{
+	const char *ctrl_type_name[] =
+	{
+#define define_ctrl_type(n)	[V4L2_CTRL_TYPE_##n] = #n
+		define_ctrl_type(INTEGER),
+		define_ctrl_type(BOOLEAN),
+		define_ctrl_type(MENU),
+		define_ctrl_type(BUTTON),
+		define_ctrl_type(INTEGER64),
+		define_ctrl_type(CTRL_CLASS),
+		define_ctrl_type(STRING),
+		define_ctrl_type(BITMASK),
+		define_ctrl_type(INTEGER_MENU),
+		define_ctrl_type(U8),
+		define_ctrl_type(U16),
+		define_ctrl_type(U32),
+	};
+	struct v4l2_query_ext_ctrl q = { };
+
+	printf ("\ncontrols...\n");
+	q.id = V4L2_CTRL_FLAG_NEXT_CTRL | V4L2_CTRL_FLAG_NEXT_COMPOUND;
+	while (ioctl (fd, VIDIOC_QUERY_EXT_CTRL, &q) == 0)
+	{
+		const char *type_name = NULL;
+		char name[sizeof (q.name)];
+
+		if (q.type < (sizeof (ctrl_type_name)/sizeof (ctrl_type_name[0])))
+			type_name = ctrl_type_name[q.type];
+		if (!type_name)
+			type_name = "unknown";
+
+		if (q.type == V4L2_CTRL_TYPE_CTRL_CLASS)
+		{
+			printf ("  %s\n", q.name);
+			goto next;
+		}
+
+		controls_name (name, sizeof (name), q.name);
+		printf ("    0x%08x %-32s %-12s", q.id, name, type_name);
+		if (q.flags & V4L2_CTRL_FLAG_HAS_PAYLOAD)
+			printf (" elems %u, elem_size %u", q.elems, q.elem_size);
+		else
+		{
+			struct v4l2_ext_control ctrl = { .id = q.id, };
+			struct v4l2_ext_controls ec = { .which = V4L2_CTRL_WHICH_CUR_VAL, .count = 1, .controls = &ctrl, };
+
+			printf (" min %lld max %lld step %llu default %lld",
+					q.minimum, q.maximum, q.step, q.default_value);
+			if (!(q.flags & V4L2_CTRL_FLAG_WRITE_ONLY) && q.type != V4L2_CTRL_TYPE_BUTTON &&
+					ioctl (fd, VIDIOC_G_EXT_CTRLS, &ec) == 0)
+				printf (" value %lld", q.type == V4L2_CTRL_TYPE_INTEGER64 ? ctrl.value64 : (long long) ctrl.value);
+		}
+		if (q.flags & V4L2_CTRL_FLAG_DISABLED)
+			printf (" disabled");
+		if (q.flags & V4L2_CTRL_FLAG_READ_ONLY)
+			printf (" read-only");
+		if (q.flags & V4L2_CTRL_FLAG_INACTIVE)
+			printf (" inactive");
+		if (q.flags & V4L2_CTRL_FLAG_VOLATILE)
+			printf (" volatile");
+		printf ("\n");
+
+		if (q.type == V4L2_CTRL_TYPE_MENU || q.type == V4L2_CTRL_TYPE_INTEGER_MENU)
+		{
+			long long i;
+
+			for (i = q.minimum; i <= q.maximum; i ++)
+			{
+				struct v4l2_querymenu menu = { .id = q.id, .index = i, };
+
+				if (ioctl (fd, VIDIOC_QUERYMENU, &menu) < 0)
+					continue;
+				if (q.type == V4L2_CTRL_TYPE_MENU)
+					printf ("      %lld: %s\n", i, menu.name);
+				else
+					printf ("      %lld: %lld\n", i, menu.value);
+			}
+		}
+
+next:
+		q.id |= V4L2_CTRL_FLAG_NEXT_CTRL | V4L2_CTRL_FLAG_NEXT_COMPOUND;
+	}
+
+	return 0;
+}
+
 int desc (const char *name)
 {
 	struct v4l2_capability caps = { };
@@ -236,6 +325,8 @@ int desc (const char *name)
 	do_desc_fmt (META_CAPTURE);
 #endif
 
+	desc_ctrls (fd);
+
 	printf ("\ninput...\n");
 	for (i=0; ; i++)
 	{
@@ -0,0 +1,73 @@
+#include <string.h>
+
+#include "h264.h"
+
+/* just past the next 00 00 01, or NULL */
+static const uint8_t *find_start (const uint8_t *p, const uint8_t *end)
+{
+	p += 2;
+	while (p < end)
+	{
+		p = memchr (p, 0x01, end - p);
+		if (!p)
+			return NULL;
+		if (p[-1] == 0 && p[-2] == 0)
+			return p + 1;
+		p ++;
+	}
+
+	return NULL;
+}
+
+int h264_next_nal (const uint8_t **pos, const uint8_t *end, struct h264_nal *nal)
+{
+	const uint8_t *p, *next, *e;
+
+	p = find_start (*pos, end);
+	if (!p || p >= end)
+	{
+		*pos = end;
+		return 0;
+	}
+
+	next = find_start (p, end);
+	e = next ? next - 3 : end;
+	/* zeros before the next start code belong to it */
+	while (e > p + 1 && e[-1] == 0)
+		e --;
+
+	nal->data = p;
+	nal->size = e - p;
+	nal->type = p[0] & 0x1f;
+	nal->ref_idc = (p[0] >> 5) & 3;
+	*pos = next ? next - 3 : end;
+
+	return 1;
+}
+
+const struct h264_au *h264_scan_au (const uint8_t *data, int size, struct h264_au *au)
+{
+	const uint8_t *end = data + size;
+	struct h264_nal nal;
+
+	if (au->scanned)
+		return au;
+
+	memset (au, 0, sizeof (*au));
+	while (h264_next_nal (&data, end, &nal))
+	{
+		if (au->nals[nal.type] < UINT16_MAX)
+			au->nals[nal.type] ++;
+		if (nal.type >= H264_NAL_SLICE && nal.type <= H264_NAL_IDR)
+		{
+			au->slices ++;
+			if (nal.ref_idc)
+				au->ref = 1;
+			if (nal.type == H264_NAL_IDR)
+				au->idr = 1;
+		}
+	}
+	au->scanned = 1;
+
+	return au;
+}
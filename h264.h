@@ -0,0 +1,45 @@
+#ifndef H264_H
+#define H264_H
+
+#include <stdint.h>
+
+/* H.264 Annex B byte stream */
+
+enum h264_nal_type
+{
+	H264_NAL_SLICE		= 1,
+	H264_NAL_IDR		= 5,
+	H264_NAL_SEI		= 6,
+	H264_NAL_SPS		= 7,
+	H264_NAL_PPS		= 8,
+	H264_NAL_AUD		= 9,
+};
+
+struct h264_nal
+{
+	const uint8_t *data;	/* NAL header byte onwards */
+	int size;
+	int type;
+	int ref_idc;
+};
+
+/*
+ * Find the NAL unit at or after *pos.  Returns 1 and advances *pos past it,
+ * or 0 when there is none left.
+ */
+int h264_next_nal (const uint8_t **pos, const uint8_t *end, struct h264_nal *nal);
+
+/* the NAL units of one access unit, a V4L2 H.264 frame */
+struct h264_au
+{
+	int scanned;
+	int slices;
+	int ref;		/* a slice with nal_ref_idc, a reference picture */
+	int idr;
+	uint16_t nals[32];	/* NAL units by type */
+};
+
+/* scan data into au, unless that was done already, and return au */
+const struct h264_au *h264_scan_au (const uint8_t *data, int size, struct h264_au *au);
+
+#endif
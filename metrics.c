@@ -0,0 +1,369 @@
+#define _GNU_SOURCE
+
+#include <linux/videodev2.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "rt.h"
+#include "h264.h"
+#include "metrics.h"
+
+#define store(var, val)		__atomic_store_n (&(var), (val), __ATOMIC_RELAXED)
+#define load(var)		__atomic_load_n (&(var), __ATOMIC_RELAXED)
+
+#define RATE_WINDOW_NS		1000000000ull
+
+struct metrics
+{
+	struct pipeline *pl;
+	uint32_t pixelformat;
+
+	/* written by the capture thread only */
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t errors;
+	uint64_t gaps;
+	uint64_t lost;
+	uint64_t nal[32];
+	uint64_t latency_ns;
+	uint64_t fps_milli;
+	uint64_t bytes_per_sec;
+
+	/* private to the capture thread */
+	int have_sequence;
+	uint32_t last_sequence;
+	uint64_t window_start;
+	uint64_t window_frames;
+	uint64_t window_bytes;
+
+	/* server */
+	char path[108];
+	int fd;
+	int quit[2];
+	pthread_t thread;
+	int started;
+	unsigned long scrapes;
+};
+
+static enum stage_result metrics_process (struct stage *st, struct frame *f)
+{
+	struct metrics *m = st->priv;
+	uint64_t now = now_ns ();
+
+	store (m->frames, m->frames + 1);
+	store (m->bytes, m->bytes + f->size);
+	if (f->flags & V4L2_BUF_FLAG_ERROR)
+		store (m->errors, m->errors + 1);
+
+	if (m->have_sequence && f->sequence != m->last_sequence + 1)
+	{
+		store (m->gaps, m->gaps + 1);
+		store (m->lost, m->lost + (uint32_t) (f->sequence - m->last_sequence - 1));
+	}
+	m->have_sequence = 1;
+	m->last_sequence = f->sequence;
+
+	/* only device timestamps, replayed ones are copied from the recording */
+	if ((f->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC &&
+			f->timestamp_ns && now > f->timestamp_ns)
+		store (m->latency_ns, now - f->timestamp_ns);
+
+	if (m->pixelformat == V4L2_PIX_FMT_H264)
+	{
+		const struct h264_au *au = h264_scan_au (f->data, f->size, &f->au);
+		int i;
+
+		for (i = 0; i < 32; i ++)
+			if (au->nals[i])
+				store (m->nal[i], m->nal[i] + au->nals[i]);
+	}
+
+	m->window_frames ++;
+	m->window_bytes += f->size;
+	if (!m->window_start)
+		m->window_start = now;
+	else if (now - m->window_start >= RATE_WINDOW_NS)
+	{
+		uint64_t ns = now - m->window_start;
+
+		store (m->fps_milli, m->window_frames * 1000000000000ull / ns);
+		store (m->bytes_per_sec, m->window_bytes * 1000000000ull / ns);
+		m->window_start = now;
+		m->window_frames = 0;
+		m->window_bytes = 0;
+	}
+
+	return STAGE_PASS;
+}
+
+#define metric(fp, name, type, help)	\
+	fprintf (fp, "# HELP capture_" name " " help "\n# TYPE capture_" name " " type "\n")
+
+static void format (struct metrics *m, FILE *fp)
+{
+	struct pipeline *pl = m->pl;
+	int i, b;
+
+	metric (fp, "frames_total", "counter", "Frames delivered.");
+	fprintf (fp, "capture_frames_total %llu\n", (unsigned long long) load (m->frames));
+	metric (fp, "bytes_total", "counter", "Bytes delivered.");
+	fprintf (fp, "capture_bytes_total %llu\n", (unsigned long long) load (m->bytes));
+	metric (fp, "fps", "gauge", "Frames per second over the last second.");
+	fprintf (fp, "capture_fps %.3f\n", load (m->fps_milli) / 1e3);
+	metric (fp, "bytes_per_second", "gauge", "Bytes per second over the last second.");
+	fprintf (fp, "capture_bytes_per_second %llu\n", (unsigned long long) load (m->bytes_per_sec));
+	metric (fp, "sequence_gaps_total", "counter", "Jumps in the buffer sequence number.");
+	fprintf (fp, "capture_sequence_gaps_total %llu\n", (unsigned long long) load (m->gaps));
+	metric (fp, "frames_lost_total", "counter", "Frames missing from the buffer sequence.");
+	fprintf (fp, "capture_frames_lost_total %llu\n", (unsigned long long) load (m->lost));
+	metric (fp, "buffer_errors_total", "counter", "Buffers flagged V4L2_BUF_FLAG_ERROR.");
+	fprintf (fp, "capture_buffer_errors_total %llu\n", (unsigned long long) load (m->errors));
+	if (load (m->latency_ns))
+	{
+		metric (fp, "latency_seconds", "gauge", "Buffer timestamp to pipeline entry of the last frame.");
+		fprintf (fp, "capture_latency_seconds %.6f\n", load (m->latency_ns) / 1e9);
+	}
+
+	if (m->pixelformat == V4L2_PIX_FMT_H264)
+	{
+		metric (fp, "nal_units_total", "counter", "H.264 NAL units by nal_unit_type.");
+		for (i = 0; i < 32; i ++)
+		{
+			uint64_t n = load (m->nal[i]);
+
+			if (n)
+				fprintf (fp, "capture_nal_units_total{type=\"%d\"} %llu\n", i, (unsigned long long) n);
+		}
+	}
+
+	metric (fp, "stage_frames_total", "counter", "Frames processed by a pipeline stage.");
+	for (i = 0; i < pl->count; i ++)
+		fprintf (fp, "capture_stage_frames_total{stage=\"%s\"} %lu\n", pl->stages[i]->name, load (pl->stages[i]->frames));
+	metric (fp, "stage_drops_total", "counter", "Frames dropped by a pipeline stage.");
+	for (i = 0; i < pl->count; i ++)
+		fprintf (fp, "capture_stage_drops_total{stage=\"%s\"} %lu\n", pl->stages[i]->name, load (pl->stages[i]->drops));
+	metric (fp, "stage_max_seconds", "gauge", "Longest process time of a pipeline stage.");
+	for (i = 0; i < pl->count; i ++)
+		fprintf (fp, "capture_stage_max_seconds{stage=\"%s\"} %.6f\n", pl->stages[i]->name, load (pl->stages[i]->max_ns) / 1e9);
+	metric (fp, "stage_seconds", "histogram", "Process time of a pipeline stage, a sink's write latency.");
+	for (i = 0; i < pl->count; i ++)
+	{
+		struct stage *st = pl->stages[i];
+		uint64_t count = 0;
+
+		for (b = 0; b < STAGE_HIST_BUCKETS; b ++)
+		{
+			count += load (st->hist[b]);
+			if (b < STAGE_HIST_BUCKETS - 1)
+				fprintf (fp, "capture_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",
+						st->name, stage_hist_bounds_ns[b] / 1e9, (unsigned long long) count);
+			else
+				fprintf (fp, "capture_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n",
+						st->name, (unsigned long long) count);
+		}
+		fprintf (fp, "capture_stage_seconds_sum{stage=\"%s\"} %.6f\n", st->name, load (st->ns) / 1e9);
+		fprintf (fp, "capture_stage_seconds_count{stage=\"%s\"} %llu\n", st->name, (unsigned long long) count);
+	}
+	metric (fp, "stage_queued", "gauge", "Frames queued in a pipeline stage.");
+	for (i = 0; i < pl->count; i ++)
+		if (pl->stages[i]->queued)
+			fprintf (fp, "capture_stage_queued{stage=\"%s\"} %d\n", pl->stages[i]->name,
+					pl->stages[i]->queued (pl->stages[i]));
+}
+
+static void serve (struct metrics *m, int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN, };
+	struct timeval tv = { .tv_sec = 1, };
+	char req[1024];
+	char *text = NULL;
+	size_t len = 0;
+	int http = 0;
+	FILE *fp;
+
+	/* a unix client may only read, an HTTP client sends its request first */
+	if (poll (&pfd, 1, 100) > 0)
+	{
+		ssize_t n = read (fd, req, sizeof (req) - 1);
+
+		http = n >= 4 && !memcmp (req, "GET ", 4);
+	}
+
+	fp = open_memstream (&text, &len);
+	if (!fp)
+		return;
+	format (m, fp);
+	fclose (fp);
+
+	setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+	if (http)
+		dprintf (fd, "HTTP/1.0 200 OK\r\n"
+				"Content-Type: text/plain; version=0.0.4\r\n"
+				"Content-Length: %zu\r\n"
+				"Connection: close\r\n"
+				"\r\n", len);
+	write_all (fd, text, len);
+	free (text);
+	m->scrapes ++;
+}
+
+static void *metrics_main (void *arg)
+{
+	struct metrics *m = arg;
+
+	rt_sink_thread ();
+
+	while (1)
+	{
+		struct pollfd pfd[2] = {
+			{ .fd = m->fd, .events = POLLIN, },
+			{ .fd = m->quit[0], .events = POLLIN, },
+		};
+		int fd;
+
+		if (poll (pfd, 2, -1) < 0 && errno != EINTR)
+			break;
+		if (pfd[1].revents)
+			break;
+		if (!(pfd[0].revents & POLLIN))
+			continue;
+
+		fd = accept4 (m->fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0)
+			continue;
+		serve (m, fd);
+		close (fd);
+	}
+
+	return NULL;
+}
+
+static int metrics_start (struct stage *st, const struct v4l2_format *fmt)
+{
+	struct metrics *m = st->priv;
+
+	m->pixelformat = fmt->fmt.pix.pixelformat;
+
+	/* the pipeline is complete now, a scrape may walk its stages */
+	if (pthread_create (&m->thread, NULL, metrics_main, m))
+	{
+		error ("cannot start metrics thread\n");
+		return -1;
+	}
+	m->started = 1;
+
+	return 0;
+}
+
+struct stage *metrics_stage_new (struct metrics *m)
+{
+	struct stage *st;
+
+	st = stage_new ("metrics", metrics_process, m);
+	if (!st)
+		return NULL;
+	st->start = metrics_start;
+
+	return st;
+}
+
+struct metrics *metrics_new (const char *spec, struct pipeline *pl)
+{
+	struct metrics *m;
+
+	m = calloc (1, sizeof (*m));
+	if (!m)
+		return NULL;
+	m->pl = pl;
+	m->fd = -1;
+	m->quit[0] = m->quit[1] = -1;
+
+	if (!strncmp (spec, "unix:", 5) && spec[5])
+	{
+		struct sockaddr_un addr = { .sun_family = AF_UNIX, };
+
+		snprintf (m->path, sizeof (m->path), "%s", spec + 5);
+		snprintf (addr.sun_path, sizeof (addr.sun_path), "%s", m->path);
+		m->fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		unlink (m->path);
+		if (m->fd < 0 || bind (m->fd, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+		{
+			error ("cannot listen on %s\n", m->path);
+			goto fail;
+		}
+	}
+	else if (!strncmp (spec, "http:", 5) && atoi (spec + 5) > 0)
+	{
+		struct sockaddr_in addr = { .sin_family = AF_INET, };
+		int one = 1;
+
+		addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+		addr.sin_port = htons (atoi (spec + 5));
+		m->fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (m->fd >= 0)
+			setsockopt (m->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+		if (m->fd < 0 || bind (m->fd, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+		{
+			error ("cannot listen on 127.0.0.1:%d\n", atoi (spec + 5));
+			goto fail;
+		}
+	}
+	else
+	{
+		fprintf (stderr, "bad metrics endpoint \"%s\", unix:<path> or http:<port>\n", spec);
+		goto fail;
+	}
+
+	if (listen (m->fd, 4) < 0 || pipe2 (m->quit, O_CLOEXEC) < 0)
+	{
+		error ("cannot start metrics server\n");
+		goto fail;
+	}
+
+	return m;
+
+fail:
+	if (m->fd >= 0)
+		close (m->fd);
+	if (m->quit[0] >= 0)
+	{
+		close (m->quit[0]);
+		close (m->quit[1]);
+	}
+	free (m);
+	return NULL;
+}
+
+void metrics_close (struct metrics *m)
+{
+	if (!m)
+		return;
+
+	if (m->started)
+	{
+		write_all (m->quit[1], "q", 1);
+		pthread_join (m->thread, NULL);
+	}
+
+	fprintf (stderr, "metrics: %lu scrapes\n", m->scrapes);
+
+	close (m->fd);
+	close (m->quit[0]);
+	close (m->quit[1]);
+	if (m->path[0])
+		unlink (m->path);
+	free (m);
+}
@@ -0,0 +1,28 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "pipeline.h"
+
+/*
+ * Live metrics in Prometheus text format.
+ *
+ * The metrics stage goes first in the pipeline and counts frames, bytes,
+ * sequence gaps, V4L2_BUF_FLAG_ERROR buffers and, for H.264, NAL units by
+ * type.  The counters and the statistics of every stage are written by the
+ * capture thread only, with relaxed atomic stores; a server thread reads
+ * them when scraped, so a scrape takes no lock the capture thread needs.
+ *
+ * spec is "unix:<path>" or "http:<port>" (bound to 127.0.0.1).  Both answer
+ * an HTTP GET; a unix client which sends nothing gets the plain text.
+ */
+
+struct metrics;
+
+/* listens right away, scrapes are answered once the pipeline starts */
+struct metrics *metrics_new (const char *spec, struct pipeline *pl);
+struct stage *metrics_stage_new (struct metrics *m);
+
+/* stop the server. call before pipeline_stop() */
+void metrics_close (struct metrics *m);
+
+#endif
@@ -0,0 +1,333 @@
+#include <linux/videodev2.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "util.h"
+#include "motion.h"
+
+#define GRID		4	/* grid sample every GRID pixels and rows */
+#define BLOCK		16	/* block of BLOCK x BLOCK grid samples */
+
+struct slot
+{
+	uint8_t *data;
+	struct frame frame;	/* as it was fed, data pointing to the copy */
+};
+
+struct motion
+{
+	struct motion_params params;
+
+	/* luma plane */
+	int luma_step;
+	int bytesperline;
+	int gw, gh;		/* grid samples */
+	int stride;		/* grid row bytes, multiple of BLOCK */
+	int bw, bh;		/* blocks */
+	uint8_t *cur;
+	uint8_t *bg;
+	int have_bg;
+
+	/* pre-roll ring */
+	int sizeimage;
+	struct slot *ring;
+	int ring_head;		/* oldest */
+	int ring_count;
+
+	int recording;
+	int post_left;
+
+	unsigned long frames;
+	unsigned long recorded;
+	unsigned long events;
+	unsigned long long bytes_total;
+	unsigned long long bytes_saved;
+	uint64_t detect_ns;
+	uint64_t detect_max_ns;
+};
+
+int motion_parse (struct motion_params *params, char *spec)
+{
+	char *const tokens[] = { "thresh", "blocks", "pre", "post", NULL, };
+	int *fields[] = { &params->threshold, &params->min_blocks, &params->pre_roll, &params->post_roll, };
+
+	while (*spec)
+	{
+		char *value;
+		int i;
+
+		i = getsubopt (&spec, tokens, &value);
+		if (i < 0 || !value)
+		{
+			fprintf (stderr, "bad motion option \"%s\", thresh=,blocks=,pre=,post=\n", value ? value : "");
+			return -1;
+		}
+		*fields[i] = atoi (value);
+	}
+
+	if (params->threshold < 1 || params->min_blocks < 1 || params->pre_roll < 0 || params->post_roll < 0)
+	{
+		fprintf (stderr, "motion options out of range\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+struct motion *motion_new (const struct motion_params *params, uint32_t pixelformat,
+		int width, int height, int bytesperline, int sizeimage)
+{
+	struct motion *m;
+	int i;
+
+	m = calloc (1, sizeof (*m));
+	if (!m)
+		return NULL;
+
+	switch (pixelformat)
+	{
+		case V4L2_PIX_FMT_YUYV:
+			m->luma_step = 2;
+			break;
+		case V4L2_PIX_FMT_GREY:
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_NV12:
+			m->luma_step = 1;
+			break;
+		default:
+			free (m);
+			return NULL;
+	}
+
+	m->params = *params;
+	m->bytesperline = bytesperline;
+	m->gw = width / GRID;
+	m->gh = height / GRID;
+	m->bw = (m->gw + BLOCK - 1) / BLOCK;
+	m->bh = (m->gh + BLOCK - 1) / BLOCK;
+	m->stride = m->bw * BLOCK;
+	m->sizeimage = sizeimage;
+
+	/* padding stays zero in both, so it never differs */
+	m->cur = calloc (m->stride, m->bh * BLOCK);
+	m->bg = calloc (m->stride, m->bh * BLOCK);
+	m->ring = calloc (params->pre_roll ? params->pre_roll : 1, sizeof (m->ring[0]));
+	if (!m->cur || !m->bg || !m->ring || !m->gw || !m->gh)
+		goto fail;
+
+	for (i = 0; i < params->pre_roll; i ++)
+	{
+		m->ring[i].data = malloc (sizeimage);
+		if (!m->ring[i].data)
+			goto fail;
+		/* fault the pages in now rather than on the first frames */
+		memset (m->ring[i].data, 0, sizeimage);
+	}
+
+	return m;
+
+fail:
+	motion_close (m);
+	return NULL;
+}
+
+static void sample_grid (struct motion *m, const uint8_t *data)
+{
+	int step = m->luma_step * GRID;
+	int x, y;
+
+	for (y = 0; y < m->gh; y ++)
+	{
+		const uint8_t *src = data + (size_t) y * GRID * m->bytesperline;
+		uint8_t *dst = m->cur + y * m->stride;
+
+		for (x = 0; x < m->gw; x ++)
+			dst[x] = src[x * step];
+	}
+}
+
+/* number of blocks which differ from the background, then blend the frame into it */
+static int moving_blocks (struct motion *m)
+{
+	uint32_t limit = m->params.threshold * BLOCK * BLOCK;
+	uint32_t sums[m->bw];
+	int moving = 0;
+	int bx, by, r;
+
+	for (by = 0; by < m->bh; by ++)
+	{
+		memset (sums, 0, sizeof (sums));
+
+		for (r = 0; r < BLOCK; r ++)
+		{
+			const uint8_t *c = m->cur + (by * BLOCK + r) * m->stride;
+			const uint8_t *b = m->bg + (by * BLOCK + r) * m->stride;
+
+			for (bx = 0; bx < m->bw; bx ++)
+			{
+#ifdef __SSE2__
+				__m128i sad = _mm_sad_epu8 (_mm_loadu_si128 ((const __m128i *) (c + bx * BLOCK)),
+						_mm_loadu_si128 ((const __m128i *) (b + bx * BLOCK)));
+
+				sums[bx] += _mm_cvtsi128_si32 (sad) + _mm_extract_epi16 (sad, 4);
+#else
+				int k;
+
+				for (k = 0; k < BLOCK; k ++)
+					sums[bx] += abs (c[bx * BLOCK + k] - b[bx * BLOCK + k]);
+#endif
+			}
+		}
+
+		for (bx = 0; bx < m->bw; bx ++)
+			if (sums[bx] > limit)
+				moving ++;
+	}
+
+	/* background follows the scene, 3/4 old + 1/4 new */
+	{
+		size_t n = (size_t) m->stride * m->bh * BLOCK;
+		size_t i = 0;
+
+#ifdef __SSE2__
+		for (; i + 16 <= n; i += 16)
+		{
+			__m128i c = _mm_loadu_si128 ((const __m128i *) (m->cur + i));
+			__m128i b = _mm_loadu_si128 ((const __m128i *) (m->bg + i));
+
+			_mm_storeu_si128 ((__m128i *) (m->bg + i), _mm_avg_epu8 (b, _mm_avg_epu8 (b, c)));
+		}
+#endif
+		for (; i < n; i ++)
+			m->bg[i] = (3 * m->bg[i] + m->cur[i] + 2) >> 2;
+	}
+
+	return moving;
+}
+
+int motion_feed (struct motion *m, const struct frame *f, motion_record_t rec, void *arg)
+{
+	const void *data = f->data;
+	int size = f->size;
+	uint64_t start;
+	uint64_t ns;
+	int motion;
+
+	m->frames ++;
+	m->bytes_total += size;
+
+	start = now_ns ();
+	if (size < m->sizeimage)
+		motion = 0;
+	else
+	{
+		sample_grid (m, data);
+		if (!m->have_bg)
+		{
+			memcpy (m->bg, m->cur, (size_t) m->stride * m->bh * BLOCK);
+			m->have_bg = 1;
+		}
+		motion = moving_blocks (m) >= m->params.min_blocks;
+	}
+	ns = now_ns () - start;
+	m->detect_ns += ns;
+	if (ns > m->detect_max_ns)
+		m->detect_max_ns = ns;
+
+	if (motion)
+	{
+		if (!m->recording)
+		{
+			if (debug_level > 0)
+				printf ("motion. recording with %d pre-roll frames\n", m->ring_count);
+			for (; m->ring_count > 0; m->ring_count --)
+			{
+				struct slot *s = &m->ring[m->ring_head];
+
+				rec (arg, &s->frame);
+				m->recorded ++;
+				m->ring_head = (m->ring_head + 1) % m->params.pre_roll;
+			}
+			m->recording = 1;
+			m->events ++;
+		}
+		m->post_left = m->params.post_roll;
+		m->recorded ++;
+		return 1;
+	}
+
+	if (m->recording)
+	{
+		if (-- m->post_left <= 0)
+		{
+			if (debug_level > 0)
+				printf ("no motion. recording stopped\n");
+			m->recording = 0;
+		}
+		m->recorded ++;
+		return 1;
+	}
+
+	if (!m->params.pre_roll)
+	{
+		m->bytes_saved += size;
+		return 0;
+	}
+
+	/* keep it in the ring, the oldest frame falls out */
+	{
+		struct slot *s;
+
+		if (m->ring_count == m->params.pre_roll)
+		{
+			m->bytes_saved += m->ring[m->ring_head].frame.size;
+			m->ring_head = (m->ring_head + 1) % m->params.pre_roll;
+			m->ring_count --;
+		}
+		s = &m->ring[(m->ring_head + m->ring_count) % m->params.pre_roll];
+		if (size > m->sizeimage)
+			size = m->sizeimage;
+		memcpy (s->data, data, size);
+		s->frame = *f;
+		s->frame.data = s->data;
+		s->frame.size = size;
+		m->ring_count ++;
+	}
+
+	return 0;
+}
+
+void motion_close (struct motion *m)
+{
+	int i;
+
+	if (!m)
+		return;
+
+	if (m->frames)
+	{
+		for (i = 0; i < m->ring_count; i ++)
+			m->bytes_saved += m->ring[(m->ring_head + i) % m->params.pre_roll].frame.size;
+
+		fprintf (stderr, "motion: %lu events, %lu/%lu frames recorded, %llu of %llu bytes saved (%.1f%%), detect %.3f ms avg %.3f ms max\n",
+				m->events, m->recorded, m->frames,
+				m->bytes_saved, m->bytes_total,
+				m->bytes_total ? 100.0 * m->bytes_saved / m->bytes_total : 0.0,
+				m->detect_ns / 1e6 / m->frames, m->detect_max_ns / 1e6);
+	}
+
+	if (m->ring)
+	{
+		for (i = 0; i < m->params.pre_roll; i ++)
+			free (m->ring[i].data);
+	}
+	free (m->ring);
+	free (m->cur);
+	free (m->bg);
+	free (m);
+}
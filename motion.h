@@ -0,0 +1,52 @@
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <stdint.h>
+
+#include "pipeline.h"
+
+/*
+ * Motion gate for raw frames.
+ *
+ * Luma is sampled on a grid of every 4th pixel of every 4th row, and the
+ * grid is compared in blocks of 16x16 samples against a running background
+ * with SIMD SAD.  A frame has motion when at least min_blocks blocks differ
+ * by more than threshold per sample on average.
+ *
+ * While there is no motion the last pre_roll frames are kept in a
+ * preallocated ring.  On motion the ring is recorded first, then every
+ * frame until post_roll frames passed without motion.
+ */
+
+struct motion_params
+{
+	int threshold;
+	int min_blocks;
+	int pre_roll;
+	int post_roll;
+};
+
+#define MOTION_PARAMS_DEFAULT	{ .threshold = 12, .min_blocks = 2, .pre_roll = 30, .post_roll = 60, }
+
+struct motion;
+
+/* "thresh=<n>,blocks=<n>,pre=<frames>,post=<frames>", returns -1 on a bad spec */
+int motion_parse (struct motion_params *params, char *spec);
+
+/* NULL when the format is not a supported raw format */
+struct motion *motion_new (const struct motion_params *params, uint32_t pixelformat,
+		int width, int height, int bytesperline, int sizeimage);
+
+typedef int (*motion_record_t) (void *arg, struct frame *f);
+
+/*
+ * Returns 1 when f is to be recorded.  Before that, record is called for
+ * the pre-roll frames, oldest first, with the sequence, flags and
+ * timestamp they were fed with.
+ */
+int motion_feed (struct motion *m, const struct frame *f, motion_record_t record, void *arg);
+
+/* print statistics and free */
+void motion_close (struct motion *m);
+
+#endif
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util.h"
+#include "pipeline.h"
+
+const uint64_t stage_hist_bounds_ns[STAGE_HIST_BUCKETS - 1] =
+{
+	50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000, 33000000,
+};
+
+#define store(var, val)		__atomic_store_n (&(var), (val), __ATOMIC_RELAXED)
+
+struct stage *stage_new (const char *name, enum stage_result (*process) (struct stage *st, struct frame *f), void *priv)
+{
+	struct stage *st;
+
+	st = calloc (1, sizeof (*st));
+	if (!st)
+		return NULL;
+
+	st->name = name;
+	st->process = process;
+	st->priv = priv;
+
+	return st;
+}
+
+int pipeline_add (struct pipeline *pl, struct stage *st)
+{
+	if (!st)
+		return -1;
+	if (pl->count >= PIPELINE_MAX_STAGES)
+	{
+		fprintf (stderr, "too many pipeline stages\n");
+		return -1;
+	}
+
+	st->pipeline = pl;
+	st->index = pl->count;
+	pl->stages[pl->count ++] = st;
+
+	return 0;
+}
+
+int pipeline_start (struct pipeline *pl, const struct v4l2_format *fmt)
+{
+	int i;
+
+	for (i = 0; i < pl->count; i ++)
+	{
+		struct stage *st = pl->stages[i];
+
+		if (st->start && st->start (st, fmt) < 0)
+		{
+			fprintf (stderr, "pipeline stage %s failed to start\n", st->name);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static enum stage_result run_from (struct pipeline *pl, int first, struct frame *f)
+{
+	int i;
+
+	for (i = first; i < pl->count; i ++)
+	{
+		struct stage *st = pl->stages[i];
+		enum stage_result ret;
+		uint64_t start;
+		uint64_t ns;
+		int b;
+
+		start = now_ns ();
+		ret = st->process (st, f);
+		ns = now_ns () - start;
+
+		for (b = 0; b < STAGE_HIST_BUCKETS - 1 && ns > stage_hist_bounds_ns[b]; b ++)
+			;
+		store (st->hist[b], st->hist[b] + 1);
+		store (st->frames, st->frames + 1);
+		store (st->ns, st->ns + ns);
+		if (ns > st->max_ns)
+			store (st->max_ns, ns);
+		if (ret != STAGE_PASS)
+		{
+			store (st->drops, st->drops + 1);
+			return ret;
+		}
+	}
+
+	return STAGE_PASS;
+}
+
+enum stage_result pipeline_run (struct pipeline *pl, struct frame *f)
+{
+	return run_from (pl, 0, f);
+}
+
+enum stage_result pipeline_forward (struct stage *st, struct frame *f)
+{
+	return run_from (st->pipeline, st->index + 1, f);
+}
+
+void pipeline_stop (struct pipeline *pl)
+{
+	int i;
+
+	for (i = 0; i < pl->count; i ++)
+	{
+		struct stage *st = pl->stages[i];
+
+		if (st->frames)
+			fprintf (stderr, "stage %-10s %8lu frames %8lu drops, %8.3f ms avg %8.3f ms max\n",
+					st->name, st->frames, st->drops,
+					st->ns / 1e6 / st->frames, st->max_ns / 1e6);
+	}
+
+	/* sinks last in, first out */
+	for (i = pl->count - 1; i >= 0; i --)
+	{
+		struct stage *st = pl->stages[i];
+
+		if (st->stop)
+			st->stop (st);
+		free (st);
+	}
+	pl->count = 0;
+}
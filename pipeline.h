@@ -0,0 +1,87 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <linux/videodev2.h>
+
+#include <stdint.h>
+
+#include "h264.h"
+
+/*
+ * Frame pipeline.
+ *
+ * Stages are put together once at startup into a flat array and every
+ * frame runs through them in order until one drops it.  A stage may filter
+ * (drop), look at the frame, or consume it.  Each stage is timed and its
+ * drops are counted, statistics are printed when the pipeline stops.
+ *
+ * The statistics are only written by the thread running the pipeline, with
+ * relaxed atomic stores, so other threads may read them at any time.
+ */
+
+struct frame
+{
+	const void *data;
+	int size;
+	uint32_t sequence;
+	uint32_t flags;		/* V4L2_BUF_FLAG_* */
+	uint64_t timestamp_ns;
+	struct h264_au au;	/* scanned by the first stage asking, h264_scan_au () */
+};
+
+enum stage_result
+{
+	STAGE_PASS = 0,
+	STAGE_DROP = 1,
+};
+
+struct pipeline;
+
+/* upper bounds of the process time histogram, the last bucket takes the rest */
+#define STAGE_HIST_BUCKETS	10
+extern const uint64_t stage_hist_bounds_ns[STAGE_HIST_BUCKETS - 1];
+
+struct stage
+{
+	const char *name;
+
+	/* all optional but process. start returns -1 on error */
+	int (*start) (struct stage *st, const struct v4l2_format *fmt);
+	enum stage_result (*process) (struct stage *st, struct frame *f);
+	void (*stop) (struct stage *st);
+	/* frames waiting in the stage, callable from any thread */
+	int (*queued) (struct stage *st);
+	void *priv;
+
+	/* kept by the pipeline */
+	struct pipeline *pipeline;
+	int index;
+	unsigned long frames;
+	unsigned long drops;
+	uint64_t ns;
+	uint64_t max_ns;
+	uint64_t hist[STAGE_HIST_BUCKETS];	/* process time, not cumulative */
+};
+
+#define PIPELINE_MAX_STAGES	16
+
+struct pipeline
+{
+	struct stage *stages[PIPELINE_MAX_STAGES];
+	int count;
+};
+
+struct stage *stage_new (const char *name, enum stage_result (*process) (struct stage *st, struct frame *f), void *priv);
+
+/* the pipeline owns st afterwards. returns -1 when full or st is NULL */
+int pipeline_add (struct pipeline *pl, struct stage *st);
+int pipeline_start (struct pipeline *pl, const struct v4l2_format *fmt);
+enum stage_result pipeline_run (struct pipeline *pl, struct frame *f);
+
+/* run f through the stages after st, for stages which emit frames of their own */
+enum stage_result pipeline_forward (struct stage *st, struct frame *f);
+
+/* stop every stage, print statistics and free the stages */
+void pipeline_stop (struct pipeline *pl);
+
+#endif
@@ -0,0 +1,395 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "rt.h"
+#include "scale.h"
+#include "preview.h"
+
+#define MAX_CLIENTS	8
+
+enum sink_type
+{
+	SINK_FILE,
+	SINK_SHM,
+	SINK_UNIX,
+};
+
+struct preview
+{
+	int width;
+	int height;
+	enum sink_type type;
+	char path[108];
+
+	struct scaler *scaler;
+	uint8_t *out;
+	size_t out_size;
+
+	int fd;
+	struct preview_shm_header *shm;
+	size_t shm_size;
+	int clients[MAX_CLIENTS];
+	int nclients;
+
+	unsigned long frames;
+	unsigned long drops;
+};
+
+struct previews
+{
+	struct preview pv[PREVIEW_MAX];
+	int count;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int started;
+	int busy;		/* frame holds a frame the thread has not finished */
+	int quit;
+
+	uint8_t *frame;
+	int sizeimage;
+
+	unsigned long fed;
+	unsigned long dropped;
+};
+
+int previews_add (struct previews **pvs, const char *spec)
+{
+	struct preview *pv;
+	char type[8];
+	int n = 0;
+
+	if (!*pvs)
+	{
+		*pvs = calloc (1, sizeof (**pvs));
+		if (!*pvs)
+			return -1;
+	}
+	if ((*pvs)->count >= PREVIEW_MAX)
+	{
+		fprintf (stderr, "too many previews, max %d\n", PREVIEW_MAX);
+		return -1;
+	}
+
+	pv = &(*pvs)->pv[(*pvs)->count];
+	memset (pv, 0, sizeof (*pv));
+	pv->fd = -1;
+	if (sscanf (spec, "%dx%d:%7[^:]:%n", &pv->width, &pv->height, type, &n) < 3 || !n || !spec[n] ||
+			strlen (spec + n) >= sizeof (pv->path))
+	{
+		fprintf (stderr, "bad preview \"%s\", <width>x<height>:<file|shm|unix>:<path>\n", spec);
+		return -1;
+	}
+	strcpy (pv->path, spec + n);
+
+	if (!strcmp (type, "file"))
+		pv->type = SINK_FILE;
+	else if (!strcmp (type, "shm"))
+		pv->type = SINK_SHM;
+	else if (!strcmp (type, "unix"))
+		pv->type = SINK_UNIX;
+	else
+	{
+		fprintf (stderr, "unknown preview sink \"%s\"\n", type);
+		return -1;
+	}
+
+	(*pvs)->count ++;
+	return 0;
+}
+
+static int open_sink (struct preview *pv, uint32_t pixelformat)
+{
+	size_t size = scaler_dst_size (pv->scaler);
+	struct sockaddr_un addr = { .sun_family = AF_UNIX, };
+
+	pv->out_size = size;
+	switch (pv->type)
+	{
+		case SINK_FILE:
+			pv->fd = open (pv->path, O_CREAT|O_WRONLY|O_TRUNC, 0644);
+			if (pv->fd < 0)
+			{
+				error ("cannot open %s\n", pv->path);
+				return -1;
+			}
+			pv->out = malloc (size);
+			break;
+
+		case SINK_SHM:
+			pv->fd = shm_open (pv->path, O_CREAT|O_RDWR, 0644);
+			if (pv->fd < 0)
+			{
+				error ("shm_open(%s) failed\n", pv->path);
+				return -1;
+			}
+			pv->shm_size = sizeof (*pv->shm) + size;
+			if (ftruncate (pv->fd, pv->shm_size) < 0)
+			{
+				error ("ftruncate(%s) failed\n", pv->path);
+				return -1;
+			}
+			pv->shm = mmap (NULL, pv->shm_size, PROT_READ|PROT_WRITE, MAP_SHARED, pv->fd, 0);
+			if (pv->shm == MAP_FAILED)
+			{
+				pv->shm = NULL;
+				error ("mmap(%s) failed\n", pv->path);
+				return -1;
+			}
+			pv->shm->seq = 0;
+			pv->shm->pixelformat = pixelformat;
+			pv->shm->width = pv->width;
+			pv->shm->height = pv->height;
+			pv->shm->bytesperline = scaler_dst_bytesperline (pv->scaler);
+			pv->shm->size = size;
+			pv->shm->frame_count = 0;
+			__atomic_store_n (&pv->shm->magic, PREVIEW_SHM_MAGIC, __ATOMIC_RELEASE);
+			/* scaled in place */
+			pv->out = (uint8_t *) (pv->shm + 1);
+			break;
+
+		case SINK_UNIX:
+			pv->fd = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+			if (pv->fd < 0)
+			{
+				error ("socket() failed\n");
+				return -1;
+			}
+			strcpy (addr.sun_path, pv->path);
+			unlink (pv->path);
+			if (bind (pv->fd, (struct sockaddr *) &addr, sizeof (addr)) < 0 || listen (pv->fd, MAX_CLIENTS) < 0)
+			{
+				error ("cannot listen on %s\n", pv->path);
+				return -1;
+			}
+			pv->out = malloc (size);
+			break;
+	}
+
+	return pv->out ? 0 : -1;
+}
+
+static void close_sink (struct preview *pv)
+{
+	int i;
+
+	for (i = 0; i < pv->nclients; i ++)
+		close (pv->clients[i]);
+
+	switch (pv->type)
+	{
+		case SINK_FILE:
+			free (pv->out);
+			break;
+
+		case SINK_SHM:
+			if (pv->shm)
+				munmap (pv->shm, pv->shm_size);
+			if (pv->fd >= 0)
+				shm_unlink (pv->path);
+			break;
+
+		case SINK_UNIX:
+			free (pv->out);
+			if (pv->fd >= 0)
+				unlink (pv->path);
+			break;
+	}
+
+	if (pv->fd >= 0)
+		close (pv->fd);
+}
+
+static void send_clients (struct preview *pv)
+{
+	int fd;
+	int i;
+
+	while (pv->nclients < MAX_CLIENTS && (fd = accept4 (pv->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		int sndbuf = pv->out_size * 2;
+
+		setsockopt (fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof (sndbuf));
+		pv->clients[pv->nclients ++] = fd;
+	}
+
+	for (i = 0; i < pv->nclients; )
+	{
+		if (send (pv->clients[i], pv->out, pv->out_size, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				pv->drops ++;
+			else
+			{
+				close (pv->clients[i]);
+				pv->clients[i] = pv->clients[-- pv->nclients];
+				continue;
+			}
+		}
+		i ++;
+	}
+}
+
+static void make_preview (struct preview *pv, const uint8_t *frame)
+{
+	switch (pv->type)
+	{
+		case SINK_FILE:
+			scaler_run (pv->scaler, frame, pv->out);
+			if (write_all (pv->fd, pv->out, pv->out_size) < 0)
+				pv->drops ++;
+			break;
+
+		case SINK_SHM:
+			__atomic_store_n (&pv->shm->seq, pv->shm->seq + 1, __ATOMIC_RELAXED);
+			__atomic_thread_fence (__ATOMIC_RELEASE);
+			scaler_run (pv->scaler, frame, pv->out);
+			pv->shm->frame_count ++;
+			__atomic_store_n (&pv->shm->seq, pv->shm->seq + 1, __ATOMIC_RELEASE);
+			break;
+
+		case SINK_UNIX:
+			scaler_run (pv->scaler, frame, pv->out);
+			send_clients (pv);
+			break;
+	}
+	pv->frames ++;
+}
+
+static void *preview_main (void *arg)
+{
+	struct previews *pvs = arg;
+	int i;
+
+	rt_sink_thread ();
+
+	pthread_mutex_lock (&pvs->lock);
+	while (1)
+	{
+		while (!pvs->busy && !pvs->quit)
+			pthread_cond_wait (&pvs->cond, &pvs->lock);
+		if (pvs->quit)
+			break;
+		pthread_mutex_unlock (&pvs->lock);
+
+		for (i = 0; i < pvs->count; i ++)
+			make_preview (&pvs->pv[i], pvs->frame);
+
+		pthread_mutex_lock (&pvs->lock);
+		pvs->busy = 0;
+	}
+	pthread_mutex_unlock (&pvs->lock);
+
+	return NULL;
+}
+
+int previews_start (struct previews *pvs, uint32_t pixelformat, int width, int height, int bytesperline, int sizeimage)
+{
+	int i;
+
+	if (!pvs)
+		return 0;
+
+	for (i = 0; i < pvs->count; i ++)
+	{
+		struct preview *pv = &pvs->pv[i];
+
+		pv->scaler = scaler_new (pixelformat, width, height, bytesperline, &pv->width, &pv->height);
+		if (!pv->scaler)
+		{
+			fprintf (stderr, "preview %dx%d: can not scale %c%c%c%c %dx%d\n", pv->width, pv->height,
+					(pixelformat >> 0) & 0xff, (pixelformat >> 8) & 0xff,
+					(pixelformat >> 16) & 0xff, (pixelformat >> 24) & 0xff,
+					width, height);
+			return -1;
+		}
+		if (open_sink (pv, pixelformat) < 0)
+			return -1;
+	}
+
+	pvs->sizeimage = sizeimage;
+	pvs->frame = malloc (sizeimage);
+	if (!pvs->frame)
+		return -1;
+
+	pthread_mutex_init (&pvs->lock, NULL);
+	pthread_cond_init (&pvs->cond, NULL);
+	if (pthread_create (&pvs->thread, NULL, preview_main, pvs))
+		return -1;
+	pvs->started = 1;
+
+	return 0;
+}
+
+void previews_feed (struct previews *pvs, const void *data, int size)
+{
+	int busy;
+
+	if (size < pvs->sizeimage)
+		return;
+
+	pthread_mutex_lock (&pvs->lock);
+	busy = pvs->busy;
+	pthread_mutex_unlock (&pvs->lock);
+	if (busy)
+	{
+		pvs->dropped ++;
+		return;
+	}
+
+	/* only this thread sets busy, the thread leaves the copy alone until then */
+	memcpy (pvs->frame, data, pvs->sizeimage);
+	pvs->fed ++;
+
+	pthread_mutex_lock (&pvs->lock);
+	pvs->busy = 1;
+	pthread_cond_signal (&pvs->cond);
+	pthread_mutex_unlock (&pvs->lock);
+}
+
+void previews_close (struct previews *pvs)
+{
+	int i;
+
+	if (!pvs)
+		return;
+
+	if (pvs->started)
+	{
+		pthread_mutex_lock (&pvs->lock);
+		pvs->quit = 1;
+		pthread_cond_signal (&pvs->cond);
+		pthread_mutex_unlock (&pvs->lock);
+		pthread_join (pvs->thread, NULL);
+
+		fprintf (stderr, "preview: %lu frames taken, %lu dropped while busy\n", pvs->fed, pvs->dropped);
+	}
+
+	for (i = 0; i < pvs->count; i ++)
+	{
+		struct preview *pv = &pvs->pv[i];
+
+		if (pvs->started)
+			fprintf (stderr, "preview %dx%d %s: %lu frames, %lu drops\n",
+					pv->width, pv->height, pv->path, pv->frames, pv->drops);
+		close_sink (pv);
+		scaler_free (pv->scaler);
+	}
+
+	free (pvs->frame);
+	free (pvs);
+}
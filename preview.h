@@ -0,0 +1,52 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <stdint.h>
+
+/*
+ * Downscaled previews of the captured stream.
+ *
+ * A preview is given as "<width>x<height>:<sink>:<path>" where sink is
+ *   file : raw frames appended to <path>
+ *   shm  : latest frame in POSIX shared memory <path>, see preview_shm_header
+ *   unix : frames sent to every client of a SOCK_SEQPACKET socket at <path>
+ *
+ * All previews are made by one thread from a private copy of the frame.
+ * When it is still busy with the previous frame the new one is dropped for
+ * the previews, so the capture thread never waits for them.
+ */
+
+#define PREVIEW_MAX		8
+#define PREVIEW_SHM_MAGIC	0x57565250	/* "PRVW" */
+
+/*
+ * Layout of a shm preview.  seq is odd while the frame is being updated;
+ * readers copy the frame and retry when seq changed meanwhile.
+ */
+struct preview_shm_header
+{
+	uint32_t magic;
+	uint32_t seq;
+	uint32_t pixelformat;
+	uint32_t width;
+	uint32_t height;
+	uint32_t bytesperline;
+	uint32_t size;
+	uint32_t reserved;
+	uint64_t frame_count;
+};
+
+struct previews;
+
+/* returns 0, or -1 when spec can not be parsed */
+int previews_add (struct previews **pvs, const char *spec);
+
+/* opens the sinks and starts the thread */
+int previews_start (struct previews *pvs, uint32_t pixelformat, int width, int height, int bytesperline, int sizeimage);
+
+void previews_feed (struct previews *pvs, const void *data, int size);
+
+/* stop the thread, print statistics and free */
+void previews_close (struct previews *pvs);
+
+#endif
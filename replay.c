@@ -0,0 +1,422 @@
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "util.h"
+#include "yuvz.h"
+#include "replay.h"
+
+struct entry
+{
+	size_t offset;
+	uint32_t size;
+	uint32_t raw_size;	/* decoded size of yuvz frames */
+	uint32_t method;
+	uint64_t timestamp_ns;
+};
+
+struct replay
+{
+	const uint8_t *map;
+	size_t map_size;
+	struct entry *entries;
+	int count;
+	int alloc;
+	int yuvz;
+};
+
+int replay_parse (struct replay_params *params, char *spec)
+{
+	char *const tokens[] = { "index", "size", "rate", "fps", "loop", NULL, };
+
+	while (*spec)
+	{
+		char *value;
+		int i;
+
+		i = getsubopt (&spec, tokens, &value);
+		if (i < 0 || !value)
+		{
+			fprintf (stderr, "bad replay option \"%s\", index=,size=,rate=,fps=,loop=\n", value ? value : "");
+			return -1;
+		}
+		switch (i)
+		{
+			case 0: params->index = value; break;
+			case 1: params->frame_size = atoi (value); break;
+			case 2: params->rate = atof (value); break;
+			case 3: params->fps = atoi (value); break;
+			case 4: params->loops = atoi (value); break;
+		}
+	}
+
+	if (params->frame_size < 0 || params->rate < 0 || params->fps < 1 || params->loops < 0)
+	{
+		fprintf (stderr, "replay options out of range\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static struct entry *add_entry (struct replay *r)
+{
+	if (r->count == r->alloc)
+	{
+		struct entry *e;
+		int alloc = r->alloc ? r->alloc * 2 : 1024;
+
+		e = realloc (r->entries, alloc * sizeof (r->entries[0]));
+		if (!e)
+			return NULL;
+		r->entries = e;
+		r->alloc = alloc;
+	}
+
+	memset (&r->entries[r->count], 0, sizeof (r->entries[0]));
+	return &r->entries[r->count ++];
+}
+
+static int scan_yuvz (struct replay *r, struct v4l2_format *fmt)
+{
+	const struct yuvz_file_header *fh = (const void *) r->map;
+	size_t offs = sizeof (*fh);
+	size_t frame_size = (size_t) fh->bytesperline * fh->height;
+	uint32_t max_size = 0;
+
+	if (fh->version != YUVZ_VERSION)
+	{
+		fprintf (stderr, "replay: yuvz version %u not supported\n", fh->version);
+		return -1;
+	}
+
+	while (offs + sizeof (struct yuvz_frame_header) <= r->map_size)
+	{
+		const struct yuvz_frame_header *h = (const void *) (r->map + offs);
+		struct entry *e;
+
+		offs += sizeof (*h);
+		if (h->sync != YUVZ_FRAME_SYNC || h->comp_size > r->map_size - offs)
+		{
+			fprintf (stderr, "replay: yuvz stream broken at frame %d, replaying the frames before\n", r->count);
+			break;
+		}
+
+		/* yuvz_decode writes whole frames, stored ones are their payload */
+		if ((h->method == YUVZ_METHOD_MED_RICE && h->raw_size != frame_size) ||
+				(h->method == YUVZ_METHOD_STORE && h->raw_size != h->comp_size))
+		{
+			fprintf (stderr, "replay: yuvz frame %u has a bad size, skipped\n", h->sequence);
+			offs += h->comp_size;
+			continue;
+		}
+
+		e = add_entry (r);
+		if (!e)
+			return -1;
+		e->offset = offs;
+		e->size = h->comp_size;
+		e->raw_size = h->raw_size;
+		e->method = h->method;
+		if (h->raw_size > max_size)
+			max_size = h->raw_size;
+
+		offs += h->comp_size;
+	}
+
+	r->yuvz = 1;
+	fmt->fmt.pix.pixelformat = fh->pixelformat;
+	fmt->fmt.pix.width = fh->width;
+	fmt->fmt.pix.height = fh->height;
+	fmt->fmt.pix.bytesperline = fh->bytesperline;
+	fmt->fmt.pix.sizeimage = max_size;
+
+	return 0;
+}
+
+static int scan_index (struct replay *r, const char *index, struct v4l2_format *fmt)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t len = 0;
+	int lineno = 0;
+	uint32_t max_size = 0;
+
+	fp = fopen (index, "r");
+	if (!fp)
+	{
+		error ("cannot open %s\n", index);
+		return -1;
+	}
+
+	while (getline (&line, &len, fp) > 0)
+	{
+		unsigned long long offset;
+		unsigned long long timestamp = 0;
+		unsigned int size;
+		struct entry *e;
+
+		lineno ++;
+		if (sscanf (line, "%llu %u %llu", &offset, &size, &timestamp) < 2)
+			continue;
+		if (offset > r->map_size || size > r->map_size - offset)
+		{
+			fprintf (stderr, "replay: %s:%d is past the end of the file\n", index, lineno);
+			continue;
+		}
+
+		e = add_entry (r);
+		if (!e)
+			break;
+		e->offset = offset;
+		e->size = size;
+		e->timestamp_ns = timestamp;
+		if (size > max_size)
+			max_size = size;
+	}
+	free (line);
+	fclose (fp);
+
+	fmt->fmt.pix.sizeimage = max_size;
+
+	return 0;
+}
+
+static int scan_fixed (struct replay *r, int frame_size, struct v4l2_format *fmt)
+{
+	size_t offs;
+
+	if (frame_size <= 0)
+		frame_size = fmt->fmt.pix.sizeimage;
+	if (frame_size <= 0)
+	{
+		fprintf (stderr, "replay: frame size unknown, give size=, index= or -w/-h of a raw format\n");
+		return -1;
+	}
+
+	for (offs = 0; offs + frame_size <= r->map_size; offs += frame_size)
+	{
+		struct entry *e;
+
+		e = add_entry (r);
+		if (!e)
+			return -1;
+		e->offset = offs;
+		e->size = frame_size;
+	}
+	if (offs != r->map_size)
+		fprintf (stderr, "replay: %zu bytes at the end are not a whole frame\n", r->map_size - offs);
+
+	fmt->fmt.pix.sizeimage = frame_size;
+
+	return 0;
+}
+
+/* bytesperline and sizeimage of the raw formats, as a driver would fill them */
+static void raw_format (struct v4l2_format *fmt, const struct replay_params *params)
+{
+	int w = params->width;
+	int h = params->height;
+
+	fmt->fmt.pix.pixelformat = params->pixelformat ? params->pixelformat : V4L2_PIX_FMT_YUYV;
+	fmt->fmt.pix.width = w > 0 ? w : 0;
+	fmt->fmt.pix.height = h > 0 ? h : 0;
+	if (w <= 0 || h <= 0)
+		return;
+
+	switch (fmt->fmt.pix.pixelformat)
+	{
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_UYVY:
+			fmt->fmt.pix.bytesperline = w * 2;
+			fmt->fmt.pix.sizeimage = w * h * 2;
+			break;
+		case V4L2_PIX_FMT_GREY:
+			fmt->fmt.pix.bytesperline = w;
+			fmt->fmt.pix.sizeimage = w * h;
+			break;
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_NV12:
+			fmt->fmt.pix.bytesperline = w;
+			fmt->fmt.pix.sizeimage = w * h * 3 / 2;
+			break;
+	}
+}
+
+static void sleep_until (uint64_t t, int *running)
+{
+	struct timespec ts = { .tv_sec = t / 1000000000ull, .tv_nsec = t % 1000000000ull, };
+
+	/* signals other than stop, a burst trigger for one, keep the pace */
+	while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && *running)
+		;
+}
+
+int replay_capture (const char *filename, const struct replay_params *params, int *running,
+		int (*got_format) (void *arg, const struct v4l2_format *fmt),
+		int (*got_frame) (void *arg, struct frame *f), void *arg)
+{
+	struct replay r = { };
+	struct v4l2_format fmt = { };
+	struct stat st;
+	uint8_t *decoded = NULL;
+	uint64_t interval = 1000000000ull / params->fps;
+	uint64_t start, base, media, prev_ts;
+	unsigned long frames = 0;
+	unsigned long late = 0;
+	unsigned long long bytes = 0;
+	int loop;
+	int ret = -1;
+	int fd;
+	int i;
+
+	fd = open (filename, O_RDONLY);
+	if (fd < 0)
+	{
+		error ("open failed. %s\n", filename);
+		return -1;
+	}
+	if (fstat (fd, &st) < 0 || st.st_size == 0)
+	{
+		error ("%s is empty\n", filename);
+		goto done;
+	}
+
+	r.map_size = st.st_size;
+	r.map = mmap (NULL, r.map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (r.map == MAP_FAILED)
+	{
+		error ("mmap() failed for %s\n", filename);
+		goto done;
+	}
+	madvise ((void *) r.map, r.map_size, MADV_SEQUENTIAL);
+
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt.fmt.pix.field = V4L2_FIELD_NONE;
+	if (r.map_size >= sizeof (struct yuvz_file_header) && !memcmp (r.map, YUVZ_MAGIC, 4))
+		ret = scan_yuvz (&r, &fmt);
+	else
+	{
+		raw_format (&fmt, params);
+		if (params->index)
+			ret = scan_index (&r, params->index, &fmt);
+		else
+			ret = scan_fixed (&r, params->frame_size, &fmt);
+	}
+	if (ret < 0)
+		goto done;
+	ret = -1;
+
+	if (!r.count)
+	{
+		fprintf (stderr, "replay: no frames in %s\n", filename);
+		goto done;
+	}
+	fprintf (stderr, "replay: %d frames, %c%c%c%c %ux%u\n", r.count,
+			(fmt.fmt.pix.pixelformat>> 0)&0xff,
+			(fmt.fmt.pix.pixelformat>> 8)&0xff,
+			(fmt.fmt.pix.pixelformat>>16)&0xff,
+			(fmt.fmt.pix.pixelformat>>24)&0xff,
+			fmt.fmt.pix.width, fmt.fmt.pix.height);
+
+	if (r.yuvz)
+	{
+		decoded = malloc (fmt.fmt.pix.sizeimage);
+		if (!decoded)
+			goto done;
+	}
+
+	if (got_format && got_format (arg, &fmt) < 0)
+		goto done;
+
+	start = now_ns ();
+	base = r.entries[0].timestamp_ns ? r.entries[0].timestamp_ns : start;
+	media = 0;
+	prev_ts = 0;
+	for (loop = 0; *running && (!params->loops || loop < params->loops); loop ++)
+	{
+		for (i = 0; *running && i < r.count; i ++)
+		{
+			const struct entry *e = &r.entries[i];
+			struct frame f = { };
+			uint64_t target = 0;
+
+			/* timeline of the recording, or fps when it has no timestamps */
+			if (frames > 0)
+			{
+				if (i > 0 && e->timestamp_ns > prev_ts && e->timestamp_ns - prev_ts < 10 * 1000000000ull)
+					media += e->timestamp_ns - prev_ts;
+				else
+					media += interval;
+			}
+			prev_ts = e->timestamp_ns;
+
+			if (params->rate > 0)
+			{
+				uint64_t now = now_ns ();
+
+				target = start + (uint64_t) (media / params->rate);
+				if (target > now)
+					sleep_until (target, running);
+				else if (now - target > interval)
+					late ++;
+				if (!*running)
+					break;
+			}
+
+			f.data = r.map + e->offset;
+			f.size = e->size;
+			if (r.yuvz)
+			{
+				f.size = e->raw_size;
+				if (e->method == YUVZ_METHOD_MED_RICE)
+				{
+					if (yuvz_decode (f.data, e->size, fmt.fmt.pix.width, fmt.fmt.pix.height,
+								fmt.fmt.pix.bytesperline, decoded) < 0)
+					{
+						fprintf (stderr, "replay: frame %d corrupted\n", i);
+						continue;
+					}
+					f.data = decoded;
+				}
+				else if (e->method != YUVZ_METHOD_STORE)
+					continue;
+			}
+			f.sequence = frames;
+			f.flags = V4L2_BUF_FLAG_TIMESTAMP_COPY;
+			/* unpaced, frames keep the recorded timeline */
+			f.timestamp_ns = target ? target : base + media;
+
+			got_frame (arg, &f);
+
+			frames ++;
+			bytes += f.size;
+		}
+	}
+
+	{
+		double sec = (now_ns () - start) / 1e9;
+
+		fprintf (stderr, "replay: %lu frames, %llu bytes in %.3f s, %.1f fps, %.1f MB/s, %lu late\n",
+				frames, bytes, sec, sec > 0 ? frames / sec : 0.0, sec > 0 ? bytes / sec / 1e6 : 0.0, late);
+	}
+	ret = 0;
+
+done:
+	if (r.map && r.map != MAP_FAILED)
+		munmap ((void *) r.map, r.map_size);
+	free (r.entries);
+	free (decoded);
+	close (fd);
+	return ret;
+}
@@ -0,0 +1,51 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <linux/videodev2.h>
+
+#include <stdint.h>
+
+#include "pipeline.h"
+
+/*
+ * Replay of a recorded stream in place of a device.
+ *
+ * The file is mapped and frames are handed out straight from the mapping.
+ * Frames are found, in this order, from
+ *   - the yuvz container, when the file starts with YUVZ_MAGIC
+ *   - an index of "<offset> <size> [<timestamp ns>]" lines, as written by
+ *     capture -I next to -o
+ *   - a fixed frame size, given or derived from the raw pixel format
+ *
+ * rate 1 replays at the recorded timestamps (or fps when there are none),
+ * other rates scale that, and rate 0 replays as fast as the pipeline takes
+ * the frames.  Frames are flagged V4L2_BUF_FLAG_TIMESTAMP_COPY, not from
+ * a device clock.  Paced frames are timestamped when they are handed out,
+ * unpaced ones with the recorded timeline, so stages measuring rates still
+ * see the recorded ones.
+ */
+
+struct replay_params
+{
+	char *index;
+	int frame_size;
+	double rate;
+	int fps;
+	int loops;		/* 0 until stopped */
+
+	/* format of a raw file */
+	uint32_t pixelformat;
+	int width;
+	int height;
+};
+
+#define REPLAY_PARAMS_DEFAULT	{ .rate = 1.0, .fps = 30, .loops = 1, }
+
+/* "index=<file>,size=<bytes>,rate=<x>,fps=<n>,loop=<n>", returns -1 on a bad spec */
+int replay_parse (struct replay_params *params, char *spec);
+
+int replay_capture (const char *filename, const struct replay_params *params, int *running,
+		int (*got_format) (void *arg, const struct v4l2_format *fmt),
+		int (*got_frame) (void *arg, struct frame *f), void *arg);
+
+#endif
@@ -0,0 +1,311 @@
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "rt.h"
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE	6
+#endif
+
+/* no glibc wrapper for sched_setattr() */
+struct sched_attr
+{
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+};
+
+static struct rt_params rt;
+static cpu_set_t capture_set;
+static cpu_set_t sink_set;
+
+static int parse_cpus (const char *list, cpu_set_t *set)
+{
+	const char *p = list;
+
+	CPU_ZERO (set);
+	while (*p)
+	{
+		char *end;
+		long a, b;
+
+		a = strtol (p, &end, 10);
+		if (end == p || a < 0 || a >= CPU_SETSIZE)
+			return -1;
+		b = a;
+		p = end;
+		if (*p == '-')
+		{
+			p ++;
+			b = strtol (p, &end, 10);
+			if (end == p || b < a || b >= CPU_SETSIZE)
+				return -1;
+			p = end;
+		}
+		for (; a <= b; a ++)
+			CPU_SET (a, set);
+
+		if (*p == ',')
+			p ++;
+		else if (*p)
+			return -1;
+	}
+
+	return CPU_COUNT (set) ? 0 : -1;
+}
+
+int rt_parse_policy (struct rt_params *params, const char *spec)
+{
+	unsigned long long runtime, period;
+
+	if (sscanf (spec, "fifo:%d", &params->priority) == 1)
+		params->policy = RT_POLICY_FIFO;
+	else if (sscanf (spec, "rr:%d", &params->priority) == 1)
+		params->policy = RT_POLICY_RR;
+	else if (sscanf (spec, "deadline:%llu:%llu", &runtime, &period) == 2 && runtime > 0 && runtime <= period)
+	{
+		params->policy = RT_POLICY_DEADLINE;
+		params->runtime_ns = runtime * 1000;
+		params->period_ns = period * 1000;
+	}
+	else
+	{
+		fprintf (stderr, "bad policy \"%s\", fifo:<prio>, rr:<prio> or deadline:<runtime us>:<period us>\n", spec);
+		return -1;
+	}
+
+	if (params->policy != RT_POLICY_DEADLINE &&
+			(params->priority < sched_get_priority_min (SCHED_FIFO) ||
+			 params->priority > sched_get_priority_max (SCHED_FIFO)))
+	{
+		fprintf (stderr, "priority %d out of range\n", params->priority);
+		return -1;
+	}
+
+	return 0;
+}
+
+int rt_setup (const struct rt_params *params)
+{
+	rt = *params;
+
+	/* the kernel refuses deadline tasks with a restricted affinity outside exclusive cpusets */
+	if (rt.capture_cpus && rt.policy == RT_POLICY_DEADLINE)
+	{
+		fprintf (stderr, "a deadline capture thread can not be pinned, drop -a or use fifo or rr\n");
+		return -1;
+	}
+	if (rt.capture_cpus && parse_cpus (rt.capture_cpus, &capture_set) < 0)
+	{
+		fprintf (stderr, "bad cpu list \"%s\"\n", rt.capture_cpus);
+		return -1;
+	}
+	if (rt.sink_cpus && parse_cpus (rt.sink_cpus, &sink_set) < 0)
+	{
+		fprintf (stderr, "bad cpu list \"%s\"\n", rt.sink_cpus);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* fault in the stack the capture loop is going to use */
+static void prefault_stack (void)
+{
+	volatile char stack[256 * 1024];
+	size_t i;
+
+	for (i = 0; i < sizeof (stack); i += 4096)
+		stack[i] = 0;
+}
+
+int rt_capture_thread (void)
+{
+	int ret = 0;
+
+	if (rt.lock_memory)
+	{
+		/* populates everything mapped so far, later mappings are locked on creation */
+		if (mlockall (MCL_CURRENT | MCL_FUTURE) < 0)
+		{
+			error ("mlockall() failed\n");
+			ret = -1;
+		}
+		prefault_stack ();
+	}
+
+	if (rt.capture_cpus &&
+			pthread_setaffinity_np (pthread_self (), sizeof (capture_set), &capture_set))
+	{
+		error ("cannot pin capture thread to %s\n", rt.capture_cpus);
+		ret = -1;
+	}
+
+	if (rt.policy == RT_POLICY_FIFO || rt.policy == RT_POLICY_RR)
+	{
+		struct sched_param param = { .sched_priority = rt.priority, };
+		int err;
+
+		err = pthread_setschedparam (pthread_self (),
+				rt.policy == RT_POLICY_FIFO ? SCHED_FIFO : SCHED_RR, &param);
+		if (err)
+		{
+			fprintf (stderr, "cannot set real-time policy. %s\n", strerror (err));
+			ret = -1;
+		}
+	}
+	else if (rt.policy == RT_POLICY_DEADLINE)
+	{
+		struct sched_attr attr = { .size = sizeof (attr), .sched_policy = SCHED_DEADLINE, };
+
+		attr.sched_runtime = rt.runtime_ns;
+		attr.sched_deadline = rt.period_ns;
+		attr.sched_period = rt.period_ns;
+		if (syscall (SYS_sched_setattr, 0, &attr, 0) < 0)
+		{
+			error ("cannot set SCHED_DEADLINE\n");
+			ret = -1;
+		}
+	}
+
+	if (debug_level > 0)
+		fprintf (stderr, "capture thread on cpu %d, policy %d\n", sched_getcpu (), sched_getscheduler (0));
+
+	return ret;
+}
+
+void rt_sink_thread (void)
+{
+	struct sched_param param = { .sched_priority = 0, };
+	int err;
+
+	/* threads inherit the policy of their creator, never the capture one */
+	err = pthread_setschedparam (pthread_self (), SCHED_OTHER, &param);
+	if (err)
+		fprintf (stderr, "cannot set sink thread to SCHED_OTHER. %s\n", strerror (err));
+
+	if (rt.sink_cpus &&
+			pthread_setaffinity_np (pthread_self (), sizeof (sink_set), &sink_set))
+		error ("cannot pin sink thread to %s\n", rt.sink_cpus);
+}
+
+void rt_prefault (const void *mem, size_t size)
+{
+	const volatile char *p = mem;
+	size_t page = sysconf (_SC_PAGESIZE);
+	size_t i;
+
+	for (i = 0; i < size; i += page)
+		(void) p[i];
+}
+
+struct rt_jitter
+{
+	int max;
+	int count;
+	uint64_t *latency;
+	uint64_t *interval;
+	uint64_t last_dequeue;
+	uint32_t last_sequence;
+	unsigned long gaps;
+};
+
+struct rt_jitter *rt_jitter_new (int max_frames)
+{
+	struct rt_jitter *j;
+
+	j = calloc (1, sizeof (*j));
+	if (!j)
+		return NULL;
+
+	j->max = max_frames;
+	j->latency = calloc (max_frames, sizeof (j->latency[0]));
+	j->interval = calloc (max_frames, sizeof (j->interval[0]));
+	if (!j->latency || !j->interval)
+	{
+		rt_jitter_free (j);
+		return NULL;
+	}
+	/* recording must not fault */
+	memset (j->latency, 0, max_frames * sizeof (j->latency[0]));
+	memset (j->interval, 0, max_frames * sizeof (j->interval[0]));
+
+	return j;
+}
+
+void rt_jitter_add (struct rt_jitter *j, uint64_t dequeue_ns, uint64_t timestamp_ns, uint32_t sequence)
+{
+	if (j->count >= j->max)
+		return;
+
+	if (j->last_dequeue)
+	{
+		if (sequence != j->last_sequence + 1)
+			j->gaps += sequence - j->last_sequence - 1;
+		j->interval[j->count] = dequeue_ns - j->last_dequeue;
+		j->latency[j->count] = timestamp_ns && dequeue_ns > timestamp_ns ? dequeue_ns - timestamp_ns : 0;
+		j->count ++;
+	}
+	j->last_dequeue = dequeue_ns;
+	j->last_sequence = sequence;
+}
+
+static int cmp_u64 (const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_percentiles (const char *name, uint64_t *v, int n)
+{
+	qsort (v, n, sizeof (v[0]), cmp_u64);
+	fprintf (stderr, "  %-16s p50 %8.3f  p90 %8.3f  p99 %8.3f  p99.9 %8.3f  max %8.3f ms\n", name,
+			v[n * 50 / 100] / 1e6, v[n * 90 / 100] / 1e6,
+			v[n * 99 / 100] / 1e6, v[(int) (n * 999LL / 1000)] / 1e6, v[n - 1] / 1e6);
+}
+
+void rt_jitter_report (struct rt_jitter *j)
+{
+	uint64_t median;
+	int i;
+
+	if (!j || j->count < 2)
+		return;
+
+	fprintf (stderr, "jitter over %d frames, %lu frames lost\n", j->count, j->gaps);
+	if (j->latency[0])
+		print_percentiles ("dequeue latency", j->latency, j->count);
+	print_percentiles ("interval", j->interval, j->count);
+
+	/* sorted now, deviation from the median interval */
+	median = j->interval[j->count / 2];
+	for (i = 0; i < j->count; i ++)
+		j->interval[i] = j->interval[i] > median ? j->interval[i] - median : median - j->interval[i];
+	print_percentiles ("interval jitter", j->interval, j->count);
+}
+
+void rt_jitter_free (struct rt_jitter *j)
+{
+	if (!j)
+		return;
+
+	free (j->latency);
+	free (j->interval);
+	free (j);
+}
@@ -0,0 +1,65 @@
+#ifndef RT_H
+#define RT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Real-time setup of the capture process.
+ *
+ * The capture thread is pinned to capture_cpus and gets the scheduling
+ * policy.  Sink threads (compression, previews, ...) call rt_sink_thread()
+ * when they start and are only pinned to sink_cpus, they stay SCHED_OTHER
+ * so they can never starve the capture thread.
+ */
+
+enum rt_policy
+{
+	RT_POLICY_NONE,
+	RT_POLICY_FIFO,
+	RT_POLICY_RR,
+	RT_POLICY_DEADLINE,
+};
+
+struct rt_params
+{
+	char *capture_cpus;	/* cpu list, "2" or "0,2-3". NULL to leave as is */
+	char *sink_cpus;
+	enum rt_policy policy;
+	int priority;		/* FIFO and RR */
+	uint64_t runtime_ns;	/* DEADLINE */
+	uint64_t period_ns;
+	int lock_memory;
+};
+
+/* "fifo:<prio>", "rr:<prio>" or "deadline:<runtime us>:<period us>" */
+int rt_parse_policy (struct rt_params *params, const char *spec);
+
+/* keep the parameters for the calls below, returns -1 on a bad cpu list or a pinned deadline policy */
+int rt_setup (const struct rt_params *params);
+
+/*
+ * lock memory and apply affinity and policy to the calling thread.  start
+ * the other threads first, a deadline thread can not create threads
+ */
+int rt_capture_thread (void);
+
+/* SCHED_OTHER and sink_cpus for the calling thread */
+void rt_sink_thread (void);
+
+/* touch every page so the first frames do not fault */
+void rt_prefault (const void *mem, size_t size);
+
+/*
+ * Jitter of frame delivery: how late a buffer is dequeued after the driver
+ * timestamped it, and how far the interval between dequeues moves.
+ */
+struct rt_jitter;
+
+struct rt_jitter *rt_jitter_new (int max_frames);
+/* timestamp_ns is the buffer timestamp in CLOCK_MONOTONIC, 0 if not available */
+void rt_jitter_add (struct rt_jitter *j, uint64_t dequeue_ns, uint64_t timestamp_ns, uint32_t sequence);
+void rt_jitter_report (struct rt_jitter *j);
+void rt_jitter_free (struct rt_jitter *j);
+
+#endif
@@ -0,0 +1,328 @@
+#include <linux/videodev2.h>
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "scale.h"
+
+#define MAX_PLANES	3
+#define MAX_CHANS	3
+
+/* one component inside the rows of a plane */
+struct chan
+{
+	int src_offset;
+	int src_step;
+	int dst_offset;
+	int dst_step;
+	int count;		/* output samples per row */
+	int *x0;		/* output sample i averages source samples x0[i] .. x0[i + 1] - 1 */
+	uint64_t *recip;	/* 2^32 / box area, for rows_of_recip source rows */
+};
+
+struct plane
+{
+	size_t src_offset;
+	int src_stride;
+	int src_rows;
+	int row_bytes;		/* bytes of a source row that are read */
+	size_t dst_offset;
+	int dst_stride;
+	int dst_rows;
+	int *y0;		/* output row j averages source rows y0[j] .. y0[j + 1] - 1 */
+	int rows_of_recip;
+	struct chan chans[MAX_CHANS];
+	int nchans;
+};
+
+struct scaler
+{
+	struct plane planes[MAX_PLANES];
+	int nplanes;
+	uint16_t *acc;
+	size_t dst_size;
+	int dst_bytesperline;
+};
+
+static int *make_spans (int src, int dst)
+{
+	int *x0;
+	int i;
+
+	x0 = malloc ((dst + 1) * sizeof (x0[0]));
+	if (!x0)
+		return NULL;
+	for (i = 0; i <= dst; i ++)
+		x0[i] = (long long) i * src / dst;
+	return x0;
+}
+
+static struct plane *add_plane (struct scaler *s,
+		size_t src_offset, int src_stride, int src_rows, int row_bytes,
+		size_t dst_offset, int dst_stride, int dst_rows)
+{
+	struct plane *p = &s->planes[s->nplanes ++];
+
+	p->src_offset = src_offset;
+	p->src_stride = src_stride;
+	p->src_rows = src_rows;
+	p->row_bytes = row_bytes;
+	p->dst_offset = dst_offset;
+	p->dst_stride = dst_stride;
+	p->dst_rows = dst_rows;
+	p->y0 = make_spans (src_rows, dst_rows);
+
+	return p;
+}
+
+static int add_chan (struct plane *p, int src_offset, int src_step, int src_count,
+		int dst_offset, int dst_step, int dst_count)
+{
+	struct chan *c = &p->chans[p->nchans ++];
+
+	c->src_offset = src_offset;
+	c->src_step = src_step;
+	c->dst_offset = dst_offset;
+	c->dst_step = dst_step;
+	c->count = dst_count;
+	c->x0 = make_spans (src_count, dst_count);
+	c->recip = malloc (dst_count * sizeof (c->recip[0]));
+
+	return c->x0 && c->recip ? 0 : -1;
+}
+
+struct scaler *scaler_new (uint32_t pixelformat, int src_width, int src_height, int src_bytesperline,
+		int *_dst_width, int *_dst_height)
+{
+	int dst_width = *_dst_width;
+	int dst_height = *_dst_height;
+	struct scaler *s;
+	struct plane *p;
+	size_t luma;
+	int ret = 0;
+	int i;
+
+	if (dst_width <= 0 || dst_height <= 0 ||
+			dst_width > src_width || dst_height > src_height ||
+			/* the 16 bit accumulator holds 257 rows of 255 */
+			(long long) dst_height * 256 < src_height ||
+			/* and a box of 257x257 still sums in 32 bits */
+			(long long) dst_width * 256 < src_width)
+		return NULL;
+
+	s = calloc (1, sizeof (*s));
+	if (!s)
+		return NULL;
+
+	switch (pixelformat)
+	{
+		case V4L2_PIX_FMT_YUYV:
+			dst_width &= ~1;
+			s->dst_bytesperline = dst_width * 2;
+			s->dst_size = (size_t) s->dst_bytesperline * dst_height;
+			p = add_plane (s, 0, src_bytesperline, src_height, src_width * 2,
+					0, s->dst_bytesperline, dst_height);
+			ret |= add_chan (p, 0, 2, src_width, 0, 2, dst_width);
+			ret |= add_chan (p, 1, 4, src_width / 2, 1, 4, dst_width / 2);
+			ret |= add_chan (p, 3, 4, src_width / 2, 3, 4, dst_width / 2);
+			break;
+
+		case V4L2_PIX_FMT_GREY:
+			s->dst_bytesperline = dst_width;
+			s->dst_size = (size_t) dst_width * dst_height;
+			p = add_plane (s, 0, src_bytesperline, src_height, src_width,
+					0, dst_width, dst_height);
+			ret |= add_chan (p, 0, 1, src_width, 0, 1, dst_width);
+			break;
+
+		case V4L2_PIX_FMT_YUV420:
+			dst_width &= ~1;
+			dst_height &= ~1;
+			s->dst_bytesperline = dst_width;
+			luma = (size_t) dst_width * dst_height;
+			s->dst_size = luma * 3 / 2;
+			p = add_plane (s, 0, src_bytesperline, src_height, src_width,
+					0, dst_width, dst_height);
+			ret |= add_chan (p, 0, 1, src_width, 0, 1, dst_width);
+			for (i = 0; i < 2; i ++)
+			{
+				p = add_plane (s,
+						(size_t) src_bytesperline * src_height + (size_t) src_bytesperline / 2 * (src_height / 2) * i,
+						src_bytesperline / 2, src_height / 2, src_width / 2,
+						luma + luma / 4 * i, dst_width / 2, dst_height / 2);
+				ret |= add_chan (p, 0, 1, src_width / 2, 0, 1, dst_width / 2);
+			}
+			break;
+
+		case V4L2_PIX_FMT_NV12:
+			dst_width &= ~1;
+			dst_height &= ~1;
+			s->dst_bytesperline = dst_width;
+			luma = (size_t) dst_width * dst_height;
+			s->dst_size = luma * 3 / 2;
+			p = add_plane (s, 0, src_bytesperline, src_height, src_width,
+					0, dst_width, dst_height);
+			ret |= add_chan (p, 0, 1, src_width, 0, 1, dst_width);
+			p = add_plane (s, (size_t) src_bytesperline * src_height, src_bytesperline, src_height / 2, src_width,
+					luma, dst_width, dst_height / 2);
+			ret |= add_chan (p, 0, 2, src_width / 2, 0, 2, dst_width / 2);
+			ret |= add_chan (p, 1, 2, src_width / 2, 1, 2, dst_width / 2);
+			break;
+
+		default:
+			ret = -1;
+			break;
+	}
+
+	for (i = 0; i < s->nplanes; i ++)
+		if (!s->planes[i].y0)
+			ret = -1;
+	s->acc = malloc (src_width * 2 * sizeof (s->acc[0]));
+	if (ret < 0 || !s->acc || !dst_width || !dst_height)
+	{
+		scaler_free (s);
+		return NULL;
+	}
+
+	*_dst_width = dst_width;
+	*_dst_height = dst_height;
+	return s;
+}
+
+void scaler_free (struct scaler *s)
+{
+	int i, j;
+
+	if (!s)
+		return;
+
+	for (i = 0; i < s->nplanes; i ++)
+	{
+		for (j = 0; j < s->planes[i].nchans; j ++)
+		{
+			free (s->planes[i].chans[j].x0);
+			free (s->planes[i].chans[j].recip);
+		}
+		free (s->planes[i].y0);
+	}
+	free (s->acc);
+	free (s);
+}
+
+size_t scaler_dst_size (const struct scaler *s)
+{
+	return s->dst_size;
+}
+
+int scaler_dst_bytesperline (const struct scaler *s)
+{
+	return s->dst_bytesperline;
+}
+
+static void acc_set (uint16_t *acc, const uint8_t *row, int n)
+{
+	int i = 0;
+
+#ifdef __SSE2__
+	const __m128i z = _mm_setzero_si128 ();
+
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i v = _mm_loadu_si128 ((const __m128i *) (row + i));
+
+		_mm_storeu_si128 ((__m128i *) (acc + i), _mm_unpacklo_epi8 (v, z));
+		_mm_storeu_si128 ((__m128i *) (acc + i + 8), _mm_unpackhi_epi8 (v, z));
+	}
+#endif
+	for (; i < n; i ++)
+		acc[i] = row[i];
+}
+
+static void acc_add (uint16_t *acc, const uint8_t *row, int n)
+{
+	int i = 0;
+
+#ifdef __SSE2__
+	const __m128i z = _mm_setzero_si128 ();
+
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i v = _mm_loadu_si128 ((const __m128i *) (row + i));
+		__m128i lo = _mm_loadu_si128 ((const __m128i *) (acc + i));
+		__m128i hi = _mm_loadu_si128 ((const __m128i *) (acc + i + 8));
+
+		_mm_storeu_si128 ((__m128i *) (acc + i), _mm_add_epi16 (lo, _mm_unpacklo_epi8 (v, z)));
+		_mm_storeu_si128 ((__m128i *) (acc + i + 8), _mm_add_epi16 (hi, _mm_unpackhi_epi8 (v, z)));
+	}
+#endif
+	for (; i < n; i ++)
+		acc[i] += row[i];
+}
+
+static void make_recip (struct plane *p, int rows)
+{
+	int i, j;
+
+	for (i = 0; i < p->nchans; i ++)
+	{
+		struct chan *c = &p->chans[i];
+
+		for (j = 0; j < c->count; j ++)
+		{
+			uint32_t area = rows * (c->x0[j + 1] - c->x0[j]);
+
+			c->recip[j] = ((1ull << 32) + area / 2) / area;
+		}
+	}
+	p->rows_of_recip = rows;
+}
+
+static void scale_plane (struct plane *p, uint16_t *acc, const uint8_t *src, uint8_t *dst)
+{
+	int i, j, y;
+
+	src += p->src_offset;
+	dst += p->dst_offset;
+
+	for (j = 0; j < p->dst_rows; j ++)
+	{
+		int rows = p->y0[j + 1] - p->y0[j];
+		uint8_t *out = dst + (size_t) j * p->dst_stride;
+
+		acc_set (acc, src + (size_t) p->y0[j] * p->src_stride, p->row_bytes);
+		for (y = p->y0[j] + 1; y < p->y0[j + 1]; y ++)
+			acc_add (acc, src + (size_t) y * p->src_stride, p->row_bytes);
+
+		if (rows != p->rows_of_recip)
+			make_recip (p, rows);
+
+		for (i = 0; i < p->nchans; i ++)
+		{
+			const struct chan *c = &p->chans[i];
+			const uint16_t *a = acc + c->src_offset;
+			uint8_t *o = out + c->dst_offset;
+			int x;
+
+			for (x = 0; x < c->count; x ++)
+			{
+				uint32_t sum = 0;
+				int k;
+
+				for (k = c->x0[x]; k < c->x0[x + 1]; k ++)
+					sum += a[k * c->src_step];
+				o[x * c->dst_step] = (sum * c->recip[x] + (1ull << 31)) >> 32;
+			}
+		}
+	}
+}
+
+void scaler_run (struct scaler *s, const uint8_t *src, uint8_t *dst)
+{
+	int i;
+
+	for (i = 0; i < s->nplanes; i ++)
+		scale_plane (&s->planes[i], s->acc, src, dst);
+}
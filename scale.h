@@ -0,0 +1,30 @@
+#ifndef SCALE_H
+#define SCALE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Box filter downscaler for raw frames.  Output keeps the input pixel
+ * format.  Supported are YUYV, GREY, YU12 and NV12, and the output must not
+ * be larger than the input nor smaller than 1/256 of it in either direction.
+ *
+ * Source rows of one output row are summed into a 16 bit accumulator with
+ * SIMD, then every output sample averages its horizontal span of it.
+ */
+
+struct scaler;
+
+/* dst_width and dst_height are rounded down to what the format allows */
+struct scaler *scaler_new (uint32_t pixelformat, int src_width, int src_height, int src_bytesperline,
+		int *dst_width, int *dst_height);
+void scaler_free (struct scaler *s);
+
+/* bytes of one output frame */
+size_t scaler_dst_size (const struct scaler *s);
+int scaler_dst_bytesperline (const struct scaler *s);
+
+/* src must be a whole frame of the source format */
+void scaler_run (struct scaler *s, const uint8_t *src, uint8_t *dst);
+
+#endif
@@ -0,0 +1,499 @@
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "yuvz_writer.h"
+#include "h264.h"
+#include "stages.h"
+
+/* skip */
+
+struct skip
+{
+	int every;
+	int count;
+};
+
+static enum stage_result skip_process (struct stage *st, struct frame *f)
+{
+	struct skip *sk = st->priv;
+
+	sk->count ++;
+	if (sk->count < sk->every)
+	{
+		if (debug_level > 0)
+			printf ("skip.   %d/%d\n", sk->count, sk->every);
+
+		return STAGE_DROP;
+	}
+
+	if (debug_level > 0)
+		printf ("handle. %d/%d\n", sk->count, sk->every);
+	sk->count = 0;
+
+	return STAGE_PASS;
+}
+
+static int skip_start (struct stage *st, const struct v4l2_format *fmt)
+{
+	if (fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_H264)
+		fprintf (stderr, "-k: dropping H.264 frames blindly breaks decoding, see -K\n");
+
+	return 0;
+}
+
+static void skip_stop (struct stage *st)
+{
+	free (st->priv);
+}
+
+struct stage *skip_stage_new (int every)
+{
+	struct skip *sk;
+	struct stage *st;
+
+	sk = calloc (1, sizeof (*sk));
+	if (!sk)
+		return NULL;
+	sk->every = every;
+
+	st = stage_new ("skip", skip_process, sk);
+	if (!st)
+	{
+		free (sk);
+		return NULL;
+	}
+	st->start = skip_start;
+	st->stop = skip_stop;
+
+	return st;
+}
+
+/* decimate */
+
+enum decimate_mode
+{
+	DECIMATE_NONREF,
+	DECIMATE_IDR,
+	DECIMATE_GOP,
+};
+
+struct decimate
+{
+	enum decimate_mode mode;
+	int gop_ratio;
+	int gop;		/* GOPs seen, -1 before the first IDR */
+
+	unsigned long frames;
+	unsigned long kept;
+	unsigned long long bytes;
+	unsigned long long kept_bytes;
+	uint64_t first_ns;
+	uint64_t last_ns;
+};
+
+static const char *const decimate_modes[] = { "nonref", "idr", "gop", };
+
+static int decimate_start (struct stage *st, const struct v4l2_format *fmt)
+{
+	if (fmt->fmt.pix.pixelformat != V4L2_PIX_FMT_H264)
+	{
+		fprintf (stderr, "-K: needs an H.264 stream\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static enum stage_result decimate_process (struct stage *st, struct frame *f)
+{
+	struct decimate *d = st->priv;
+	const struct h264_au *au = h264_scan_au (f->data, f->size, &f->au);
+	int keep;
+
+	if (au->idr)
+		d->gop ++;
+
+	if (!au->slices)
+		keep = 1;
+	else if (d->mode == DECIMATE_NONREF)
+		keep = au->ref;
+	else if (d->mode == DECIMATE_IDR)
+		keep = au->idr;
+	else
+		keep = d->gop >= 0 && d->gop % d->gop_ratio == 0;
+
+	d->frames ++;
+	d->bytes += f->size;
+	if (f->timestamp_ns)
+	{
+		if (!d->first_ns)
+			d->first_ns = f->timestamp_ns;
+		d->last_ns = f->timestamp_ns;
+	}
+	if (!keep)
+		return STAGE_DROP;
+
+	d->kept ++;
+	d->kept_bytes += f->size;
+
+	return STAGE_PASS;
+}
+
+static void decimate_stop (struct stage *st)
+{
+	struct decimate *d = st->priv;
+
+	if (d->frames)
+	{
+		double sec = (d->last_ns - d->first_ns) / 1e9;
+
+		fprintf (stderr, "decimate %s: %lu/%lu frames kept, %llu -> %llu bytes (%.1f%% less)",
+				decimate_modes[d->mode], d->kept, d->frames, d->bytes, d->kept_bytes,
+				d->bytes ? 100.0 - 100.0 * d->kept_bytes / d->bytes : 0.0);
+		if (sec > 0)
+			fprintf (stderr, ", %.0f -> %.0f kbit/s", d->bytes * 8 / sec / 1e3, d->kept_bytes * 8 / sec / 1e3);
+		fprintf (stderr, "\n");
+	}
+	free (d);
+}
+
+struct stage *decimate_stage_new (const char *mode)
+{
+	struct decimate *d;
+	struct stage *st;
+
+	d = calloc (1, sizeof (*d));
+	if (!d)
+		return NULL;
+	d->gop = -1;
+
+	if (!strcmp (mode, "nonref"))
+		d->mode = DECIMATE_NONREF;
+	else if (!strcmp (mode, "idr"))
+		d->mode = DECIMATE_IDR;
+	else if (!strncmp (mode, "gop=", 4) && atoi (mode + 4) > 0)
+	{
+		d->mode = DECIMATE_GOP;
+		d->gop_ratio = atoi (mode + 4);
+	}
+	else
+	{
+		fprintf (stderr, "bad decimation mode \"%s\", nonref, idr or gop=<n>\n", mode);
+		free (d);
+		return NULL;
+	}
+
+	st = stage_new ("decimate", decimate_process, d);
+	if (!st)
+	{
+		free (d);
+		return NULL;
+	}
+	st->start = decimate_start;
+	st->stop = decimate_stop;
+
+	return st;
+}
+
+/* dump */
+
+static enum stage_result dump_process (struct stage *st, struct frame *f)
+{
+	const unsigned char *data = f->data;
+	const unsigned char *p;
+	int offs;
+	int zeros;
+	bool got_start;
+
+	zeros = 0;
+	got_start = false;
+	for (offs = 0, p = data; p < data + f->size; p ++, offs ++)
+	{
+		if (got_start)
+		{
+			const unsigned char *t = p - zeros;
+
+			printf ("%02x %02x %02x %02x %02x %02x %02x %02x - NAL type %2d at offs %d\n",
+					t[0], t[1], t[2], t[3], t[4], t[5], t[6], t[7],
+					*p & 0x1f, offs);
+			got_start = false;
+			zeros = 0;
+		}
+		else
+		{
+			if (*p == 0)
+				zeros ++;
+			else if (zeros > 2 && *p == 0x01)
+				got_start = true;
+			else
+				zeros = 0;
+		}
+	}
+
+	return STAGE_PASS;
+}
+
+struct stage *dump_stage_new (int level)
+{
+	return stage_new ("dump", dump_process, NULL);
+}
+
+/* single */
+
+static enum stage_result single_process (struct stage *st, struct frame *f)
+{
+	const char *filename = st->priv;
+	char *tmp_fname = NULL;
+
+	asprintf (&tmp_fname, "%s.tmp", filename);
+	if (tmp_fname)
+	{
+		int out;
+
+		out = open (tmp_fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (out >= 0)
+		{
+			ssize_t written;
+
+			written = write (out, f->data, f->size);
+			if (debug_level > 0)
+				printf ("%zd written\n", written);
+			close (out);
+			if (rename (tmp_fname, filename) < 0)
+				error ("rename() failed. %s(%d)\n", strerror(errno), errno);
+		}
+		else
+			error ("open(%s) failed. %s(%d)\n", tmp_fname, strerror(errno), errno);
+
+		free (tmp_fname);
+	}
+
+	return STAGE_PASS;
+}
+
+struct stage *single_stage_new (const char *filename)
+{
+	return stage_new ("single", single_process, (void *) filename);
+}
+
+/* preview */
+
+static int preview_start (struct stage *st, const struct v4l2_format *fmt)
+{
+	return previews_start (st->priv, fmt->fmt.pix.pixelformat,
+			fmt->fmt.pix.width, fmt->fmt.pix.height,
+			fmt->fmt.pix.bytesperline, fmt->fmt.pix.sizeimage);
+}
+
+static enum stage_result preview_process (struct stage *st, struct frame *f)
+{
+	previews_feed (st->priv, f->data, f->size);
+
+	return STAGE_PASS;
+}
+
+static void preview_stop (struct stage *st)
+{
+	previews_close (st->priv);
+}
+
+struct stage *preview_stage_new (struct previews *pvs)
+{
+	struct stage *st;
+
+	st = stage_new ("preview", preview_process, pvs);
+	if (!st)
+		return NULL;
+	st->start = preview_start;
+	st->stop = preview_stop;
+
+	return st;
+}
+
+/* motion */
+
+struct motion_stage
+{
+	struct motion_params params;
+	struct motion *motion;
+	struct stage *st;
+};
+
+static int motion_start (struct stage *st, const struct v4l2_format *fmt)
+{
+	struct motion_stage *ms = st->priv;
+
+	ms->motion = motion_new (&ms->params, fmt->fmt.pix.pixelformat,
+			fmt->fmt.pix.width, fmt->fmt.pix.height,
+			fmt->fmt.pix.bytesperline, fmt->fmt.pix.sizeimage);
+	if (!ms->motion)
+	{
+		fprintf (stderr, "-m: motion detection needs a raw format\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* a pre-roll frame goes on ahead of the current one */
+static int motion_preroll (void *arg, struct frame *f)
+{
+	struct motion_stage *ms = arg;
+
+	return pipeline_forward (ms->st, f) == STAGE_PASS ? 0 : -1;
+}
+
+static enum stage_result motion_process (struct stage *st, struct frame *f)
+{
+	struct motion_stage *ms = st->priv;
+
+	if (motion_feed (ms->motion, f, motion_preroll, ms))
+		return STAGE_PASS;
+
+	return STAGE_DROP;
+}
+
+static void motion_stop (struct stage *st)
+{
+	struct motion_stage *ms = st->priv;
+
+	motion_close (ms->motion);
+	free (ms);
+}
+
+struct stage *motion_stage_new (const struct motion_params *params)
+{
+	struct motion_stage *ms;
+	struct stage *st;
+
+	ms = calloc (1, sizeof (*ms));
+	if (!ms)
+		return NULL;
+	ms->params = *params;
+
+	st = stage_new ("motion", motion_process, ms);
+	if (!st)
+	{
+		free (ms);
+		return NULL;
+	}
+	st->start = motion_start;
+	st->stop = motion_stop;
+	ms->st = st;
+
+	return st;
+}
+
+/* record */
+
+struct record
+{
+	int fd;
+	int compress_threads;
+	struct yuvz_writer *zw;
+	FILE *index;
+	unsigned long long offset;
+};
+
+static int record_start (struct stage *st, const struct v4l2_format *fmt)
+{
+	struct record *r = st->priv;
+	struct yuvz_file_header fh = { .magic = YUVZ_MAGIC, .version = YUVZ_VERSION, };
+
+	if (r->compress_threads <= 0)
+		return 0;
+
+	if (fmt->fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV)
+		fprintf (stderr, "-z: not a YUYV stream, frames are stored uncompressed\n");
+
+	fh.pixelformat = fmt->fmt.pix.pixelformat;
+	fh.width = fmt->fmt.pix.width;
+	fh.height = fmt->fmt.pix.height;
+	fh.bytesperline = fmt->fmt.pix.bytesperline;
+	r->zw = yuvz_writer_new (r->fd, &fh, fmt->fmt.pix.sizeimage, r->compress_threads);
+	if (!r->zw)
+	{
+		error ("cannot start compression\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static enum stage_result record_process (struct stage *st, struct frame *f)
+{
+	struct record *r = st->priv;
+
+	if (r->zw)
+		yuvz_writer_put (r->zw, f->data, f->size);
+	else if (write_all (r->fd, f->data, f->size) == f->size)
+	{
+		if (r->index)
+			fprintf (r->index, "%llu %d %llu\n", r->offset, f->size, (unsigned long long) f->timestamp_ns);
+		r->offset += f->size;
+	}
+
+	return STAGE_PASS;
+}
+
+static int record_queued (struct stage *st)
+{
+	struct record *r = st->priv;
+
+	return r->zw ? yuvz_writer_queued (r->zw) : 0;
+}
+
+static void record_stop (struct stage *st)
+{
+	struct record *r = st->priv;
+
+	yuvz_writer_close (r->zw);
+	close (r->fd);
+	if (r->index)
+		fclose (r->index);
+	free (r);
+}
+
+struct stage *record_stage_new (int fd, int compress_threads, int index_fd)
+{
+	struct record *r;
+	struct stage *st;
+
+	r = calloc (1, sizeof (*r));
+	if (!r)
+		return NULL;
+	r->fd = fd;
+	r->compress_threads = compress_threads;
+	if (index_fd >= 0)
+	{
+		r->index = fdopen (index_fd, "w");
+		if (!r->index)
+		{
+			free (r);
+			return NULL;
+		}
+	}
+
+	st = stage_new ("record", record_process, r);
+	if (!st)
+	{
+		if (r->index)
+			fclose (r->index);
+		free (r);
+		return NULL;
+	}
+	st->start = record_start;
+	st->stop = record_stop;
+	st->queued = record_queued;
+
+	return st;
+}
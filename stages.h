@@ -0,0 +1,47 @@
+#ifndef STAGES_H
+#define STAGES_H
+
+#include "pipeline.h"
+#include "preview.h"
+#include "motion.h"
+
+/*
+ * Stages of capture.  They are meant to be put together as
+ *   filters (skip) -> taps (preview, dump, single) -> gate (motion) -> sink (record)
+ * so a tap never sees a frame which was filtered out, and a gate only
+ * decides for the sinks after it.
+ */
+
+/* pass one of every <every> frames */
+struct stage *skip_stage_new (int every);
+
+/*
+ * Drop H.264 access units without breaking decoding.  mode is
+ *   nonref : drop frames whose slices all have nal_ref_idc 0
+ *   idr    : keep IDR frames only, for time-lapse
+ *   gop=<n>: keep one of every <n> GOPs
+ * Frames without slices (SPS, PPS, SEI only) are always kept.  NULL on a
+ * bad mode.
+ */
+struct stage *decimate_stage_new (const char *mode);
+
+/* print the NAL units of the stream */
+struct stage *dump_stage_new (int level);
+
+/* keep the latest frame in filename, replaced atomically */
+struct stage *single_stage_new (const char *filename);
+
+/* the pipeline owns pvs afterwards */
+struct stage *preview_stage_new (struct previews *pvs);
+
+/* pass frames only around motion, the pre-roll is forwarded ahead of them */
+struct stage *motion_stage_new (const struct motion_params *params);
+
+/*
+ * write frames to fd, compressed with yuvz when compress_threads > 0.
+ * Unless index_fd is -1, a "<offset> <size> <timestamp ns>" line is written
+ * to it for every frame.  Both are closed at stop.
+ */
+struct stage *record_stage_new (int fd, int compress_threads, int index_fd);
+
+#endif
@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "util.h"
+
+int debug_level;
+
+void _error (const char *fmt, ...)
+{
+	va_list ap;
+	int en = errno;
+
+	va_start (ap, fmt);
+	vfprintf (stdout, fmt, ap);
+	va_end (ap);
+	fprintf (stdout, "errno %d, %s\n", en, strerror (en));
+}
+
+ssize_t write_all (int fd, const void *data, size_t size)
+{
+	size_t done = 0;
+
+	while (done < size)
+	{
+		ssize_t ret;
+
+		ret = write (fd, (const char *) data + done, size - done);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		done += ret;
+	}
+
+	return done;
+}
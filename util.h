@@ -0,0 +1,25 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define error(fmt,args...)	_error("%s.%d "fmt, __func__, __LINE__, ##args)
+void _error (const char *fmt, ...) __attribute__((format (printf, 1, 2)));
+
+extern int debug_level;
+
+/* write() until done. returns size, or -1 */
+ssize_t write_all (int fd, const void *data, size_t size);
+
+static inline uint64_t now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#endif
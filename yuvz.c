@@ -0,0 +1,518 @@
+#include <linux/videodev2.h>
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "yuvz.h"
+
+#define BLOCK		16
+#define ESCAPE		16	/* unary prefix which introduces a raw byte */
+
+/*
+ * Bits are packed LSB first into little endian words, so the writer only
+ * ever ORs new bits above the pending ones and the reader finds unary
+ * prefixes with a count of trailing zeros.
+ */
+struct bitwriter
+{
+	uint64_t acc;
+	int bits;		/* pending bits in acc, < 8 between symbols */
+	uint8_t *p;
+	uint8_t *end;
+	int overflow;
+};
+
+struct bitreader
+{
+	const uint8_t *p;
+	int pos;		/* bit position in *p */
+	const uint8_t *end;
+	int overrun;
+};
+
+/* longest code, a raw byte or q = ESCAPE - 1 with k = 7 */
+#define CODE_MAX_BITS	(ESCAPE + 1 + 8)
+
+#define CODE_MASK	((1u << 26) - 1)
+
+/* worst case output of one block plus the 8 byte spill of put_bits() */
+#define BLOCK_MAX_BYTES	((3 + CODE_MAX_BITS * BLOCK) / 8 + 1 + 8)
+
+static inline void store_le64 (uint8_t *p, uint64_t v)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64 (v);
+#endif
+	memcpy (p, &v, 8);
+}
+
+static inline uint64_t load_le64 (const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy (&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64 (v);
+#endif
+	return v;
+}
+
+/*
+ * n <= 56.  Always stores the whole accumulator and advances by the
+ * complete bytes, so there is no branch per symbol.  The caller makes sure
+ * there is room for a whole block beforehand.
+ */
+static inline void put_bits (struct bitwriter *bw, uint64_t v, int n)
+{
+	bw->acc |= v << bw->bits;
+	bw->bits += n;
+	store_le64 (bw->p, bw->acc);
+	bw->p += bw->bits >> 3;
+	bw->acc >>= bw->bits & ~7;
+	bw->bits &= 7;
+}
+
+static void flush_bits (struct bitwriter *bw)
+{
+	if (bw->bits > 0)
+	{
+		if (bw->p >= bw->end)
+		{
+			bw->overflow = 1;
+			return;
+		}
+		*bw->p++ = bw->acc;
+	}
+	bw->acc = 0;
+	bw->bits = 0;
+}
+
+/* at least 57 valid bits, starting at bit 0 */
+static inline uint64_t peek_bits (struct bitreader *br)
+{
+	uint8_t tmp[8] = { };
+
+	if (br->p + 8 <= br->end)
+		return load_le64 (br->p) >> br->pos;
+
+	if (br->p < br->end)
+		memcpy (tmp, br->p, br->end - br->p);
+	else
+		br->overrun ++;
+	return load_le64 (tmp) >> br->pos;
+}
+
+static inline void skip_bits (struct bitreader *br, int n)
+{
+	br->pos += n;
+	br->p += br->pos >> 3;
+	br->pos &= 7;
+}
+
+/* MED predictor, the median of a, b and a + b - c */
+static inline int med (int a, int b, int c)
+{
+	int mx = a > b ? a : b;
+	int mn = a > b ? b : a;
+	int g = a + b - c;
+
+	g = g < mx ? g : mx;
+	return g > mn ? g : mn;
+}
+
+static inline uint8_t zigzag (int r)
+{
+	int8_t s = (int8_t) r;
+
+	return (uint8_t) ((s << 1) ^ (s >> 7));
+}
+
+static inline int unzigzag (int v)
+{
+	return (v >> 1) ^ -(v & 1);
+}
+
+/*
+ * Predict sample i of a YUYV row.  Luma neighbours are 2 bytes apart and
+ * chroma neighbours 4 bytes.  up is NULL for the first row.
+ */
+static inline int predict (const uint8_t *cur, const uint8_t *up, int i)
+{
+	int d = (i & 1) ? 4 : 2;
+
+	if (!up)
+		return i >= d ? cur[i - d] : 0;
+	if (i < d)
+		return up[i];
+	return med (cur[i - d], up[i], up[i - d]);
+}
+
+#ifdef __SSE2__
+static inline __m128i med_epu8 (__m128i a, __m128i b, __m128i c)
+{
+	__m128i z = _mm_setzero_si128 ();
+	__m128i lo, hi, g;
+
+	/* a + b - c clamped to 0..255 does not change the median */
+	lo = _mm_sub_epi16 (_mm_add_epi16 (_mm_unpacklo_epi8 (a, z), _mm_unpacklo_epi8 (b, z)), _mm_unpacklo_epi8 (c, z));
+	hi = _mm_sub_epi16 (_mm_add_epi16 (_mm_unpackhi_epi8 (a, z), _mm_unpackhi_epi8 (b, z)), _mm_unpackhi_epi8 (c, z));
+	g = _mm_packus_epi16 (lo, hi);
+
+	return _mm_max_epu8 (_mm_min_epu8 (a, b), _mm_min_epu8 (_mm_max_epu8 (a, b), g));
+}
+
+static inline __m128i zigzag_epi8 (__m128i r)
+{
+	return _mm_xor_si128 (_mm_add_epi8 (r, r), _mm_cmpgt_epi8 (_mm_setzero_si128 (), r));
+}
+
+static inline __m128i loadu (const uint8_t *p)
+{
+	return _mm_loadu_si128 ((const __m128i *) p);
+}
+#endif
+
+/* zigzag coded residuals of one row, in YUYV order */
+static void residual_row (const uint8_t *cur, const uint8_t *up, int width, uint8_t *r)
+{
+	int n = width * 2;
+	int i;
+
+	if (!up)
+	{
+		for (i = 0; i < n; i ++)
+			r[i] = zigzag (cur[i] - predict (cur, NULL, i));
+		return;
+	}
+
+	for (i = 0; i < 4 && i < n; i ++)
+		r[i] = zigzag (cur[i] - predict (cur, up, i));
+
+#ifdef __SSE2__
+	{
+		/* luma lanes take the neighbour 2 bytes back, chroma lanes 4 bytes back */
+		const __m128i luma = _mm_set1_epi16 (0x00ff);
+
+		for (; i + 16 <= n; i += 16)
+		{
+			__m128i a = _mm_or_si128 (_mm_and_si128 (luma, loadu (cur + i - 2)), _mm_andnot_si128 (luma, loadu (cur + i - 4)));
+			__m128i c = _mm_or_si128 (_mm_and_si128 (luma, loadu (up + i - 2)), _mm_andnot_si128 (luma, loadu (up + i - 4)));
+			__m128i p = med_epu8 (a, loadu (up + i), c);
+
+			_mm_storeu_si128 ((__m128i *) (r + i), zigzag_epi8 (_mm_sub_epi8 (loadu (cur + i), p)));
+		}
+	}
+#endif
+
+	for (; i < n; i ++)
+	{
+		int d = (i & 1) ? 4 : 2;
+
+		r[i] = zigzag (cur[i] - med (cur[i - d], up[i], up[i - d]));
+	}
+}
+
+/* split YUYV ordered samples into luma and chroma runs */
+static void split_row (const uint8_t *r, int width, uint8_t *ry, uint8_t *rc)
+{
+	int i = 0;
+
+#ifdef __SSE2__
+	{
+		const __m128i luma = _mm_set1_epi16 (0x00ff);
+
+		for (; i + 16 <= width; i += 16)
+		{
+			__m128i v0 = loadu (r + 2*i);
+			__m128i v1 = loadu (r + 2*i + 16);
+
+			_mm_storeu_si128 ((__m128i *) (ry + i), _mm_packus_epi16 (_mm_and_si128 (v0, luma), _mm_and_si128 (v1, luma)));
+			_mm_storeu_si128 ((__m128i *) (rc + i), _mm_packus_epi16 (_mm_srli_epi16 (v0, 8), _mm_srli_epi16 (v1, 8)));
+		}
+	}
+#endif
+
+	for (; i < width; i ++)
+	{
+		ry[i] = r[2*i];
+		rc[i] = r[2*i + 1];
+	}
+}
+
+/* k = log2 (mean) */
+static inline int choose_k (unsigned int sum, int len)
+{
+	unsigned int mean = len == BLOCK ? sum / BLOCK : sum / len;
+	int k;
+
+	if (!mean)
+		return 0;
+	k = 31 - __builtin_clz (mean);
+	return k > 7 ? 7 : k;
+}
+
+static inline unsigned int block_sum (const uint8_t *r, int len)
+{
+	unsigned int sum = 0;
+	int j;
+
+#ifdef __SSE2__
+	if (len == BLOCK)
+	{
+		__m128i sad = _mm_sad_epu8 (loadu (r), _mm_setzero_si128 ());
+
+		return _mm_cvtsi128_si32 (sad) + _mm_extract_epi16 (sad, 4);
+	}
+#endif
+	for (j = 0; j < len; j ++)
+		sum += r[j];
+	return sum;
+}
+
+/*
+ * Rice code of v: q zeros, a one, then the low k bits.  Large values escape
+ * to a raw byte.  Codes of every k and v are tabled, the length in the top
+ * 6 bits of each entry.
+ */
+static uint32_t rice_table[8][256];
+
+static void __attribute__((constructor)) init_rice_table (void)
+{
+	int k, v;
+
+	for (k = 0; k < 8; k ++)
+	{
+		for (v = 0; v < 256; v ++)
+		{
+			uint32_t q = v >> k;
+
+			if (q < ESCAPE)
+				rice_table[k][v] = (((v & ((1u << k) - 1)) << (q + 1)) | (1u << q)) | ((q + 1 + k) << 26);
+			else
+				rice_table[k][v] = ((v << (ESCAPE + 1)) | (1u << ESCAPE)) | ((ESCAPE + 1 + 8) << 26);
+		}
+	}
+}
+
+static void put_run (struct bitwriter *out, const uint8_t *r, int n)
+{
+	/* local copy, stores through bw->p could alias *out */
+	struct bitwriter _bw = *out;
+	struct bitwriter *bw = &_bw;
+	int i, j;
+
+	for (i = 0; i < n; i += BLOCK)
+	{
+		int len = n - i < BLOCK ? n - i : BLOCK;
+		const uint32_t *table;
+		int k;
+
+		if (bw->end - bw->p < BLOCK_MAX_BYTES)
+		{
+			bw->overflow = 1;
+			break;
+		}
+
+		k = choose_k (block_sum (r + i, len), len);
+		table = rice_table[k];
+		put_bits (bw, k, 3);
+
+		/* two codes per put, 2 * CODE_MAX_BITS fit above the 7 pending bits */
+		for (j = 0; j + 1 < len; j += 2)
+		{
+			uint32_t c0 = table[r[i + j]];
+			uint32_t c1 = table[r[i + j + 1]];
+			int l0 = c0 >> 26;
+
+			put_bits (bw, (c0 & CODE_MASK) | ((uint64_t) (c1 & CODE_MASK) << l0), l0 + (c1 >> 26));
+		}
+		if (j < len)
+		{
+			uint32_t c0 = table[r[i + j]];
+
+			put_bits (bw, c0 & CODE_MASK, c0 >> 26);
+		}
+	}
+
+	*out = _bw;
+}
+
+static int get_run (struct bitreader *in, uint8_t *r, int n)
+{
+	struct bitreader _br = *in;
+	struct bitreader *br = &_br;
+	int ret = 0;
+	int i, j;
+
+	for (i = 0; i < n; i += BLOCK)
+	{
+		int len = n - i < BLOCK ? n - i : BLOCK;
+		uint32_t mask;
+		int k;
+
+		k = peek_bits (br) & 7;
+		skip_bits (br, 3);
+		mask = (1u << k) - 1;
+
+		for (j = 0; j < len; j ++)
+		{
+			uint64_t v = peek_bits (br);
+			int q;
+
+			if (!v)
+			{
+				ret = -1;
+				goto done;
+			}
+			q = __builtin_ctzll (v);
+			if (q < ESCAPE)
+			{
+				r[i + j] = (q << k) | ((v >> (q + 1)) & mask);
+				skip_bits (br, q + 1 + k);
+			}
+			else if (q == ESCAPE)
+			{
+				r[i + j] = v >> (ESCAPE + 1);
+				skip_bits (br, ESCAPE + 1 + 8);
+			}
+			else
+			{
+				ret = -1;
+				goto done;
+			}
+		}
+	}
+
+done:
+	*in = _br;
+	return ret;
+}
+
+size_t yuvz_bound (int width, int height)
+{
+	/* anything larger than the raw frame is stored instead */
+	return (size_t) width * 2 * height + 64;
+}
+
+size_t yuvz_encode (const uint8_t *src, int width, int height, int bytesperline,
+		uint8_t *dst, size_t dst_size)
+{
+	struct bitwriter bw = { .p = dst, .end = dst + dst_size, };
+	uint8_t *r;
+	uint8_t *ry;
+	int y;
+
+	if (width <= 0 || (width & 1) || height <= 0 || bytesperline < width * 2)
+		return 0;
+
+	r = malloc (width * 4);
+	if (!r)
+		return 0;
+	ry = r + width * 2;
+
+	for (y = 0; y < height && !bw.overflow; y ++)
+	{
+		const uint8_t *cur = src + (size_t) y * bytesperline;
+		const uint8_t *up = y ? cur - bytesperline : NULL;
+
+		residual_row (cur, up, width, r);
+		split_row (r, width, ry, ry + width);
+		put_run (&bw, ry, width);
+		put_run (&bw, ry + width, width);
+	}
+	if (!bw.overflow)
+		flush_bits (&bw);
+
+	free (r);
+	if (bw.overflow)
+		return 0;
+	return bw.p - dst;
+}
+
+int yuvz_decode (const uint8_t *src, size_t src_size, int width, int height, int bytesperline,
+		uint8_t *dst)
+{
+	struct bitreader br = { .p = src, .end = src + src_size, };
+	uint8_t *ry;
+	int ret = 0;
+	int y;
+
+	if (width <= 0 || (width & 1) || height <= 0 || bytesperline < width * 2)
+		return -1;
+
+	ry = malloc (width * 2);
+	if (!ry)
+		return -1;
+
+	for (y = 0; y < height; y ++)
+	{
+		uint8_t *cur = dst + (size_t) y * bytesperline;
+		const uint8_t *up = y ? cur - bytesperline : NULL;
+		const uint8_t *rc = ry + width;
+		int m;
+
+		if (get_run (&br, ry, width) < 0 || get_run (&br, ry + width, width) < 0)
+		{
+			ret = -1;
+			break;
+		}
+
+		for (m = 0; m < width / 2 && (!up || m < 1); m ++)
+		{
+			cur[4*m + 0] = predict (cur, up, 4*m + 0) + unzigzag (ry[2*m + 0]);
+			cur[4*m + 1] = predict (cur, up, 4*m + 1) + unzigzag (rc[2*m + 0]);
+			cur[4*m + 2] = predict (cur, up, 4*m + 2) + unzigzag (ry[2*m + 1]);
+			cur[4*m + 3] = predict (cur, up, 4*m + 3) + unzigzag (rc[2*m + 1]);
+		}
+		for (; m < width / 2; m ++)
+		{
+			uint8_t *c = cur + 4*m;
+			const uint8_t *u = up + 4*m;
+
+			c[0] = med (c[-2], u[0], u[-2]) + unzigzag (ry[2*m + 0]);
+			c[1] = med (c[-3], u[1], u[-3]) + unzigzag (rc[2*m + 0]);
+			c[2] = med (c[0], u[2], u[0]) + unzigzag (ry[2*m + 1]);
+			c[3] = med (c[-1], u[3], u[-1]) + unzigzag (rc[2*m + 1]);
+		}
+		memset (cur + width * 2, 0, bytesperline - width * 2);
+	}
+
+	free (ry);
+	if (br.overrun)
+		ret = -1;
+	return ret;
+}
+
+size_t yuvz_pack_frame (const struct yuvz_file_header *fh, uint32_t sequence,
+		const void *data, size_t size, uint8_t *dst)
+{
+	struct yuvz_frame_header *h = (struct yuvz_frame_header *) dst;
+	uint8_t *payload = dst + sizeof (*h);
+	size_t comp = 0;
+
+	h->sync = YUVZ_FRAME_SYNC;
+	h->sequence = sequence;
+	h->raw_size = size;
+
+	if (fh->pixelformat == V4L2_PIX_FMT_YUYV &&
+			size == (size_t) fh->bytesperline * fh->height)
+		comp = yuvz_encode (data, fh->width, fh->height, fh->bytesperline,
+				payload, size < yuvz_bound (fh->width, fh->height) ? size : yuvz_bound (fh->width, fh->height));
+
+	if (comp > 0 && comp < size)
+	{
+		h->method = YUVZ_METHOD_MED_RICE;
+		h->comp_size = comp;
+	}
+	else
+	{
+		h->method = YUVZ_METHOD_STORE;
+		h->comp_size = size;
+		memcpy (payload, data, size);
+	}
+
+	return sizeof (*h) + h->comp_size;
+}
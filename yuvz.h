@@ -0,0 +1,69 @@
+#ifndef YUVZ_H
+#define YUVZ_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * yuvz - lossless compression for packed YUYV frames.
+ *
+ * Every sample is predicted from its left, upper and upper-left neighbours
+ * of the same channel (MED predictor of LOCO-I) and the residuals are coded
+ * with Rice codes whose parameter is chosen per block of 16 samples.  Luma
+ * and chroma residuals of a row are coded as separate runs so each block
+ * sees one channel only.
+ *
+ * Container: one yuvz_file_header, then for every frame a yuvz_frame_header
+ * followed by comp_size bytes of payload.  Frames that can not be coded
+ * (short frames, other pixel formats) or do not shrink are stored as is.
+ */
+
+#define YUVZ_MAGIC		"YUVZ"
+#define YUVZ_VERSION		1
+#define YUVZ_FRAME_SYNC		0x4d415246	/* "FRAM" */
+
+enum yuvz_method
+{
+	YUVZ_METHOD_STORE	= 0,
+	YUVZ_METHOD_MED_RICE	= 1,
+};
+
+struct yuvz_file_header
+{
+	char		magic[4];
+	uint32_t	version;
+	uint32_t	pixelformat;
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	bytesperline;
+} __attribute__((packed));
+
+struct yuvz_frame_header
+{
+	uint32_t	sync;
+	uint32_t	sequence;
+	uint32_t	method;
+	uint32_t	raw_size;
+	uint32_t	comp_size;
+} __attribute__((packed));
+
+/* worst case payload size of yuvz_encode() */
+size_t yuvz_bound (int width, int height);
+
+/* returns payload size, or 0 if dst_size is too small */
+size_t yuvz_encode (const uint8_t *src, int width, int height, int bytesperline,
+		uint8_t *dst, size_t dst_size);
+
+/* returns 0, or -1 on a corrupted payload */
+int yuvz_decode (const uint8_t *src, size_t src_size, int width, int height, int bytesperline,
+		uint8_t *dst);
+
+/*
+ * Compress one frame into dst (header and payload), falling back to
+ * YUVZ_METHOD_STORE.  dst must hold sizeof (struct yuvz_frame_header) +
+ * size bytes.  Returns the number of bytes to write.
+ */
+size_t yuvz_pack_frame (const struct yuvz_file_header *fh, uint32_t sequence,
+		const void *data, size_t size, uint8_t *dst);
+
+#endif
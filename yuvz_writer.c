@@ -0,0 +1,270 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "rt.h"
+#include "yuvz_writer.h"
+
+enum slot_state
+{
+	SLOT_FREE,
+	SLOT_FILLED,
+	SLOT_BUSY,
+	SLOT_DONE,
+};
+
+struct slot
+{
+	enum slot_state state;
+	uint32_t sequence;
+	size_t size;
+	uint8_t *raw;
+	uint8_t *out;
+	size_t out_size;
+};
+
+struct yuvz_writer
+{
+	int fd;
+	struct yuvz_file_header fh;
+	size_t max_frame;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct slot *slots;
+	int nslots;
+	int head;		/* next slot to fill */
+	int next;		/* next slot to compress */
+	int tail;		/* next slot to write */
+	int queued;		/* slots not free */
+	int closing;
+
+	pthread_t *workers;
+	int nworkers;
+	pthread_t writer;
+
+	uint32_t sequence;
+	unsigned long long raw_bytes;
+	unsigned long long out_bytes;
+	unsigned long long compress_ns;
+	unsigned int waits;
+	unsigned int write_errors;
+};
+
+static void *worker_main (void *arg)
+{
+	struct yuvz_writer *w = arg;
+
+	rt_sink_thread ();
+
+	pthread_mutex_lock (&w->lock);
+	while (1)
+	{
+		struct slot *s = &w->slots[w->next];
+		uint64_t start;
+
+		if (s->state != SLOT_FILLED)
+		{
+			if (w->closing)
+				break;
+			pthread_cond_wait (&w->cond, &w->lock);
+			continue;
+		}
+
+		s->state = SLOT_BUSY;
+		w->next = (w->next + 1) % w->nslots;
+		pthread_mutex_unlock (&w->lock);
+
+		start = now_ns ();
+		s->out_size = yuvz_pack_frame (&w->fh, s->sequence, s->raw, s->size, s->out);
+
+		pthread_mutex_lock (&w->lock);
+		w->compress_ns += now_ns () - start;
+		s->state = SLOT_DONE;
+		pthread_cond_broadcast (&w->cond);
+	}
+	pthread_mutex_unlock (&w->lock);
+
+	return NULL;
+}
+
+static void *writer_main (void *arg)
+{
+	struct yuvz_writer *w = arg;
+
+	rt_sink_thread ();
+
+	pthread_mutex_lock (&w->lock);
+	while (1)
+	{
+		struct slot *s = &w->slots[w->tail];
+
+		if (s->state != SLOT_DONE)
+		{
+			if (w->closing && s->state == SLOT_FREE)
+				break;
+			pthread_cond_wait (&w->cond, &w->lock);
+			continue;
+		}
+		pthread_mutex_unlock (&w->lock);
+
+		if (write_all (w->fd, s->out, s->out_size) < 0)
+			w->write_errors ++;
+
+		pthread_mutex_lock (&w->lock);
+		w->raw_bytes += s->size;
+		w->out_bytes += s->out_size;
+		s->state = SLOT_FREE;
+		__atomic_store_n (&w->queued, w->queued - 1, __ATOMIC_RELAXED);
+		w->tail = (w->tail + 1) % w->nslots;
+		pthread_cond_broadcast (&w->cond);
+	}
+	pthread_mutex_unlock (&w->lock);
+
+	return NULL;
+}
+
+struct yuvz_writer *yuvz_writer_new (int fd, const struct yuvz_file_header *fh, size_t max_frame, int threads)
+{
+	struct yuvz_writer *w;
+	int i;
+
+	if (threads < 1)
+		threads = 1;
+
+	w = calloc (1, sizeof (*w));
+	if (!w)
+		return NULL;
+
+	w->fd = fd;
+	w->fh = *fh;
+	w->max_frame = max_frame;
+	w->nslots = threads * 2 + 2;
+	pthread_mutex_init (&w->lock, NULL);
+	pthread_cond_init (&w->cond, NULL);
+
+	w->slots = calloc (w->nslots, sizeof (w->slots[0]));
+	w->workers = calloc (threads, sizeof (w->workers[0]));
+	if (!w->slots || !w->workers)
+		goto fail;
+	for (i = 0; i < w->nslots; i ++)
+	{
+		w->slots[i].raw = malloc (max_frame);
+		w->slots[i].out = malloc (sizeof (struct yuvz_frame_header) + max_frame);
+		if (!w->slots[i].raw || !w->slots[i].out)
+			goto fail;
+	}
+
+	if (write_all (fd, fh, sizeof (*fh)) < 0)
+	{
+		error ("cannot write yuvz header\n");
+		goto fail;
+	}
+
+	for (; w->nworkers < threads; w->nworkers ++)
+		if (pthread_create (&w->workers[w->nworkers], NULL, worker_main, w))
+			break;
+	if (w->nworkers < threads || pthread_create (&w->writer, NULL, writer_main, w))
+	{
+		error ("cannot start yuvz threads\n");
+		pthread_mutex_lock (&w->lock);
+		w->closing = 1;
+		pthread_cond_broadcast (&w->cond);
+		pthread_mutex_unlock (&w->lock);
+		for (i = 0; i < w->nworkers; i ++)
+			pthread_join (w->workers[i], NULL);
+		goto fail;
+	}
+
+	return w;
+
+fail:
+	if (w->slots)
+	{
+		for (i = 0; i < w->nslots; i ++)
+		{
+			free (w->slots[i].raw);
+			free (w->slots[i].out);
+		}
+	}
+	free (w->slots);
+	free (w->workers);
+	free (w);
+	return NULL;
+}
+
+int yuvz_writer_put (struct yuvz_writer *w, const void *data, size_t size)
+{
+	struct slot *s;
+
+	if (size > w->max_frame)
+	{
+		fprintf (stderr, "yuvz: frame too large, %zu > %zu\n", size, w->max_frame);
+		return -1;
+	}
+
+	pthread_mutex_lock (&w->lock);
+	s = &w->slots[w->head];
+	if (s->state != SLOT_FREE)
+	{
+		w->waits ++;
+		while (s->state != SLOT_FREE)
+			pthread_cond_wait (&w->cond, &w->lock);
+	}
+	pthread_mutex_unlock (&w->lock);
+
+	/* the slot is ours until it is marked filled */
+	memcpy (s->raw, data, size);
+	s->size = size;
+	s->sequence = w->sequence ++;
+
+	pthread_mutex_lock (&w->lock);
+	s->state = SLOT_FILLED;
+	__atomic_store_n (&w->queued, w->queued + 1, __ATOMIC_RELAXED);
+	w->head = (w->head + 1) % w->nslots;
+	pthread_cond_broadcast (&w->cond);
+	pthread_mutex_unlock (&w->lock);
+
+	return 0;
+}
+
+int yuvz_writer_queued (struct yuvz_writer *w)
+{
+	return __atomic_load_n (&w->queued, __ATOMIC_RELAXED);
+}
+
+void yuvz_writer_close (struct yuvz_writer *w)
+{
+	int i;
+
+	if (!w)
+		return;
+
+	pthread_mutex_lock (&w->lock);
+	w->closing = 1;
+	pthread_cond_broadcast (&w->cond);
+	pthread_mutex_unlock (&w->lock);
+
+	for (i = 0; i < w->nworkers; i ++)
+		pthread_join (w->workers[i], NULL);
+	pthread_join (w->writer, NULL);
+
+	fprintf (stderr, "yuvz: %u frames, %llu -> %llu bytes (%.2fx), %.1f MB/s per thread, %u producer waits, %u write errors\n",
+			w->sequence, w->raw_bytes, w->out_bytes,
+			w->out_bytes ? (double) w->raw_bytes / w->out_bytes : 0.0,
+			w->compress_ns ? w->raw_bytes * 1e3 / w->compress_ns : 0.0,
+			w->waits, w->write_errors);
+
+	for (i = 0; i < w->nslots; i ++)
+	{
+		free (w->slots[i].raw);
+		free (w->slots[i].out);
+	}
+	free (w->slots);
+	free (w->workers);
+	pthread_mutex_destroy (&w->lock);
+	pthread_cond_destroy (&w->cond);
+	free (w);
+}
@@ -0,0 +1,26 @@
+#ifndef YUVZ_WRITER_H
+#define YUVZ_WRITER_H
+
+#include <stddef.h>
+
+#include "yuvz.h"
+
+/*
+ * Writes a yuvz stream to fd.  Frames are copied into a ring of slots,
+ * compressed by a pool of worker threads and written in order by a writer
+ * thread, so the caller only pays for the copy.  The caller blocks when all
+ * slots are in use.
+ */
+
+struct yuvz_writer;
+
+struct yuvz_writer *yuvz_writer_new (int fd, const struct yuvz_file_header *fh, size_t max_frame, int threads);
+int yuvz_writer_put (struct yuvz_writer *w, const void *data, size_t size);
+
+/* frames put and not written yet. does not lock, may be called from any thread */
+int yuvz_writer_queued (struct yuvz_writer *w);
+
+/* drain pending frames, print statistics and free */
+void yuvz_writer_close (struct yuvz_writer *w);
+
+#endif
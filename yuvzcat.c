@@ -0,0 +1,349 @@
+#include <linux/videodev2.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "util.h"
+#include "yuvz.h"
+
+static const uint8_t *map_file (const char *name, size_t *size)
+{
+	struct stat st;
+	void *mem;
+	int fd;
+
+	fd = open (name, O_RDONLY);
+	if (fd < 0)
+	{
+		error ("cannot open %s\n", name);
+		return NULL;
+	}
+	if (fstat (fd, &st) < 0 || st.st_size == 0)
+	{
+		error ("empty or unreadable %s\n", name);
+		close (fd);
+		return NULL;
+	}
+
+	mem = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (mem == MAP_FAILED)
+	{
+		error ("mmap() failed for %s\n", name);
+		return NULL;
+	}
+
+	*size = st.st_size;
+	return mem;
+}
+
+static int decompress (const uint8_t *in, size_t size, int outfd)
+{
+	const struct yuvz_file_header *fh = (const void *) in;
+	size_t offs = sizeof (*fh);
+	uint8_t *frame = NULL;
+	size_t frame_size;
+	int count = 0;
+
+	if (size < sizeof (*fh) || memcmp (fh->magic, YUVZ_MAGIC, 4) || fh->version != YUVZ_VERSION)
+	{
+		fprintf (stderr, "not a yuvz stream\n");
+		return -1;
+	}
+
+	/* yuvz_decode writes whole frames whatever raw_size says */
+	frame_size = (size_t) fh->bytesperline * fh->height;
+
+	while (offs + sizeof (struct yuvz_frame_header) <= size)
+	{
+		const struct yuvz_frame_header *h = (const void *) (in + offs);
+		const uint8_t *payload = in + offs + sizeof (*h);
+
+		if (h->sync != YUVZ_FRAME_SYNC || offs + sizeof (*h) + h->comp_size > size)
+		{
+			fprintf (stderr, "frame %d: broken header at offs %zu\n", count, offs);
+			break;
+		}
+
+		if (h->method == YUVZ_METHOD_STORE)
+			write_all (outfd, payload, h->comp_size);
+		else if (h->method == YUVZ_METHOD_MED_RICE)
+		{
+			if (!frame)
+			{
+				frame = malloc (frame_size);
+				if (!frame)
+				{
+					fprintf (stderr, "cannot allocate a %zu bytes frame\n", frame_size);
+					return -1;
+				}
+			}
+			if (h->raw_size != frame_size ||
+					yuvz_decode (payload, h->comp_size, fh->width, fh->height, fh->bytesperline, frame) < 0)
+			{
+				fprintf (stderr, "frame %d (seq %u): corrupted\n", count, h->sequence);
+				break;
+			}
+			write_all (outfd, frame, h->raw_size);
+		}
+		else
+			fprintf (stderr, "frame %d (seq %u): unknown method %u\n", count, h->sequence, h->method);
+
+		offs += sizeof (*h) + h->comp_size;
+		count ++;
+	}
+
+	if (debug_level > 0)
+		fprintf (stderr, "%d frames\n", count);
+	free (frame);
+	return 0;
+}
+
+static int compress (const uint8_t *in, size_t size, struct yuvz_file_header *fh, int outfd)
+{
+	size_t frame_size = (size_t) fh->bytesperline * fh->height;
+	uint8_t *out;
+	uint32_t seq;
+	size_t offs;
+
+	out = malloc (sizeof (struct yuvz_frame_header) + frame_size);
+	if (!out)
+		return -1;
+
+	write_all (outfd, fh, sizeof (*fh));
+	for (offs = 0, seq = 0; offs < size; offs += frame_size, seq ++)
+	{
+		size_t len = size - offs < frame_size ? size - offs : frame_size;
+
+		write_all (outfd, out, yuvz_pack_frame (fh, seq, in + offs, len, out));
+	}
+
+	free (out);
+	return 0;
+}
+
+/*
+ * gradient, some texture, a moving box and sensor noise of a webcam in
+ * indoor light, about 2.2 levels rms on luma and 1.6 on chroma.  only used
+ * when no capture is given
+ */
+static uint8_t *synth_frames (int width, int height, int count, size_t *size)
+{
+	size_t frame_size = (size_t) width * 2 * height;
+	unsigned int seed = 1;
+	uint8_t *buf;
+	int n, x, y;
+
+	buf = malloc (frame_size * count);
+	if (!buf)
+		return NULL;
+
+	for (n = 0; n < count; n ++)
+	{
+		uint8_t *f = buf + frame_size * n;
+		int box = width >= 64 ? (n * 4) % (width / 64) : -1;
+
+		for (y = 0; y < height; y ++)
+		{
+			for (x = 0; x < width * 2; x ++)
+			{
+				int v, k, noise = 0;
+
+				if (x & 1)
+					v = 128 + ((x & 2) ? y : x / 2) * 32 / (width + height);
+				else
+				{
+					v = 16 + (x / 2 + y) * 200 / (width + height);
+					/* fine stripes in the lower right quarter */
+					if (x / 2 >= width / 2 && y >= height / 2)
+						v += (x / 2 + y / 3) % 7 < 3 ? 24 : -24;
+				}
+				if (!(x & 1) && x / 2 / 64 == box && y / 64 == 3)
+					v = 220;
+				for (k = 0; k < ((x & 1) ? 2 : 4); k ++)
+				{
+					seed = seed * 1103515245 + 12345;
+					noise += (seed >> 16) & 3;
+				}
+				v += noise - ((x & 1) ? 3 : 6);
+				f[(size_t) y * width * 2 + x] = v < 0 ? 0 : v > 255 ? 255 : v;
+			}
+		}
+	}
+
+	*size = frame_size * count;
+	return buf;
+}
+
+static int bench (const uint8_t *in, size_t size, struct yuvz_file_header *fh, int synthetic)
+{
+	size_t frame_size = (size_t) fh->bytesperline * fh->height;
+	uint64_t enc_ns = 0;
+	uint64_t dec_ns = 0;
+	unsigned long long raw = 0;
+	unsigned long long comp = 0;
+	uint8_t *out;
+	uint8_t *back;
+	int frames = 0;
+	size_t offs;
+
+	out = malloc (frame_size + 64);
+	back = malloc (frame_size);
+	if (!out || !back)
+		return -1;
+
+	for (offs = 0; offs + frame_size <= size; offs += frame_size, frames ++)
+	{
+		const uint8_t *src = in + offs;
+		uint64_t t0, t1, t2;
+		size_t len;
+
+		t0 = now_ns ();
+		len = yuvz_encode (src, fh->width, fh->height, fh->bytesperline, out, frame_size + 64);
+		t1 = now_ns ();
+		if (!len || yuvz_decode (out, len, fh->width, fh->height, fh->bytesperline, back) < 0 ||
+				memcmp (src, back, frame_size))
+		{
+			fprintf (stderr, "frame %d: round trip mismatch\n", frames);
+			return -1;
+		}
+		t2 = now_ns ();
+
+		enc_ns += t1 - t0;
+		dec_ns += t2 - t1;
+		raw += frame_size;
+		comp += len;
+	}
+
+	if (!frames)
+	{
+		fprintf (stderr, "input is smaller than one %ux%u frame\n", fh->width, fh->height);
+		return -1;
+	}
+
+	printf ("%d %sframes %ux%u, %llu -> %llu bytes, ratio %.2fx\n",
+			frames, synthetic ? "synthetic " : "", fh->width, fh->height, raw, comp, (double) raw / comp);
+	printf ("encode %7.1f MB/s %6.2f ms/frame (%.1fx real time at 30fps)\n",
+			raw * 1e3 / enc_ns, enc_ns / 1e6 / frames, 1e9 / 30 * frames / enc_ns);
+	printf ("decode %7.1f MB/s %6.2f ms/frame (%.1fx real time at 30fps)\n",
+			raw * 1e3 / dec_ns, dec_ns / 1e6 / frames, 1e9 / 30 * frames / dec_ns);
+
+	free (out);
+	free (back);
+	return 0;
+}
+
+int main (int argc, char **argv)
+{
+	struct yuvz_file_header fh = { .magic = YUVZ_MAGIC, .version = YUVZ_VERSION, .pixelformat = V4L2_PIX_FMT_YUYV, };
+	const char *opt_output = NULL;
+	int opt_compress = 0;
+	int opt_bench = 0;
+	const uint8_t *in = NULL;
+	size_t size = 0;
+	int outfd = 1;
+	int ret;
+
+	while (1)
+	{
+		int opt;
+
+		opt = getopt (argc, argv, "?o:cbw:h:D");
+		if (opt < 0)
+			break;
+
+		switch (opt)
+		{
+			case '?':
+				fprintf (stderr,
+					" $ yuvzcat <options> <file>\n"
+					"options:\n"
+					" -o <filename>       : output. default stdout\n"
+					" -c                  : compress raw YUYV input instead of decompressing\n"
+					" -b                  : benchmark the codec on raw YUYV input. synthetic frames without <file>\n"
+					" -w <width>          : width of raw input\n"
+					" -h <height>         : height of raw input\n"
+					" -D                  : increase debug level\n"
+					);
+				exit (1);
+
+			case 'o':
+				opt_output = optarg;
+				break;
+
+			case 'c':
+				opt_compress = 1;
+				break;
+
+			case 'b':
+				opt_bench = 1;
+				break;
+
+			case 'w':
+			case 'h':
+				if (atoi (optarg) <= 0 || (opt == 'w' && (atoi (optarg) & 1)))
+				{
+					fprintf (stderr, "bad -%c %s, an even width and a positive height\n", opt, optarg);
+					exit (1);
+				}
+				if (opt == 'w')
+					fh.width = atoi (optarg);
+				else
+					fh.height = atoi (optarg);
+				break;
+
+			case 'D':
+				debug_level ++;
+				break;
+		}
+	}
+	fh.bytesperline = fh.width * 2;
+
+	if ((opt_compress || opt_bench) && (!fh.width || !fh.height))
+	{
+		if (!opt_bench || optind < argc)
+		{
+			fprintf (stderr, "-c and -b require -w and -h\n");
+			exit (1);
+		}
+		fh.width = 1920;
+		fh.height = 1080;
+		fh.bytesperline = fh.width * 2;
+	}
+
+	if (optind < argc)
+		in = map_file (argv[optind], &size);
+	else if (opt_bench)
+		in = synth_frames (fh.width, fh.height, 30, &size);
+	if (!in)
+		exit (1);
+
+	if (opt_bench)
+		return bench (in, size, &fh, optind >= argc) < 0 ? 1 : 0;
+
+	if (opt_output)
+	{
+		outfd = open (opt_output, O_CREAT|O_WRONLY|O_TRUNC, 0644);
+		if (outfd < 0)
+		{
+			error ("cannot open %s\n", opt_output);
+			exit (1);
+		}
+	}
+
+	if (opt_compress)
+		ret = compress (in, size, &fh, outfd);
+	else
+		ret = decompress (in, size, outfd);
+
+	close (outfd);
+	return ret < 0 ? 1 : 0;
+}